@@ -1,6 +1,7 @@
 #include "src/chunk_generation_application.h"
 #include "src/compute_shader_application.h"
 #include "src/config.h"
+#include "src/pool_allocator.h"
 #include <spdlog/spdlog.h>
 
 int main(int argc, char *argv[]) {
@@ -8,9 +9,17 @@ int main(int argc, char *argv[]) {
     spdlog::set_pattern("[%H:%M:%S.%e] [%l] [thread %t] %v");
     Config config{argc, argv};
     spdlog::set_level(config.loglevel);
-    if (config.chunkgen) {
+    if (config.allocatorBenchmarkChunks > 0) {
+        benchmarkPoolAllocators(config.allocatorBenchmarkChunks);
+        return EXIT_SUCCESS;
+    }
+    if (config.chunkgen || config.mergeShards) {
         ChunkGenerationApplication app{config};
-        app.genererateChunks();
+        if (config.mergeShards) {
+            app.mergeShards();
+        } else {
+            app.genererateChunks();
+        }
         return EXIT_SUCCESS;
     }
 
@@ -0,0 +1,267 @@
+#include "async_chunk_io.h"
+
+#include <bit>
+#include <cerrno>
+
+#include "spdlog/spdlog.h"
+
+void Log2Histogram::add(uint64_t value) {
+    size_t bucket = std::min<size_t>(std::bit_width(value), BUCKETS - 1);
+    counts[bucket].fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t Log2Histogram::total() const {
+    uint64_t sum = 0;
+    for (const auto &count: counts) {
+        sum += count.load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+uint64_t Log2Histogram::percentile(double p) const {
+    uint64_t sum = total();
+    if (sum == 0) return 0;
+    auto target = static_cast<uint64_t>(std::ceil(p * static_cast<double>(sum)));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKETS; i++) {
+        seen += counts[i].load(std::memory_order_relaxed);
+        if (seen >= target) {
+            return i == 0 ? 0 : (uint64_t{1} << i) - 1;
+        }
+    }
+    return (uint64_t{1} << (BUCKETS - 1)) - 1;
+}
+
+void Log2Histogram::reset() {
+    for (auto &count: counts) {
+        count.store(0, std::memory_order_relaxed);
+    }
+}
+
+AsyncChunkReader::AsyncChunkReader(uint32_t queueDepth, uint32_t threadCount)
+    : queueDepth(std::max(queueDepth, 1u)) {
+#ifdef USE_IO_URING
+    //Every request can be split into three reads (octree, far values and node colors), so give the ring room for all.
+    if (io_uring_queue_init(this->queueDepth * 3, &ring, 0) == 0) {
+        usingUring = true;
+        reaper = std::thread([this]() { this->reaperLoop(); });
+    } else {
+        spdlog::warn("io_uring not available, falling back to a thread pool for chunk reads");
+    }
+#endif
+    if (!usingUring) {
+        threadCount = std::max(threadCount, 1u);
+        for (uint32_t i = 0; i < threadCount; i++) {
+            workers.emplace_back([this]() { this->workerLoop(); });
+        }
+    }
+}
+
+AsyncChunkReader::~AsyncChunkReader() {
+    //Let all reads finish first, the destinations are owned by the caller.
+    {
+        std::unique_lock<std::mutex> lock(capacityMutex);
+        capacityCv.wait(lock, [this] { return inFlightCount.load() == 0; });
+    }
+#ifdef USE_IO_URING
+    if (usingUring) {
+        {
+            //A nop without user data tells the reaper to stop.
+            std::lock_guard<std::mutex> lock(ringMutex);
+            io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+            io_uring_prep_nop(sqe);
+            io_uring_sqe_set_data(sqe, nullptr);
+            io_uring_submit(&ring);
+        }
+        reaper.join();
+        io_uring_queue_exit(&ring);
+    }
+#endif
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        stopFlag = true;
+    }
+    pendingCv.notify_all();
+    for (auto &worker: workers) {
+        worker.join();
+    }
+}
+
+void AsyncChunkReader::submit(const ChunkReadRequest &request) {
+    {
+        std::unique_lock<std::mutex> lock(capacityMutex);
+        capacityCv.wait(lock, [this] { return inFlightCount.load() < queueDepth; });
+        inFlightCount++;
+    }
+    depthHistogram.add(inFlightCount.load());
+
+    auto *operation = new ReadOperation{};
+    operation->request = request;
+    operation->submitted = std::chrono::steady_clock::now();
+    operation->success = true;
+
+    size_t gpuDataBytes = request.file->gpuDataSize * sizeof(uint32_t);
+    size_t farValuesBytes = request.file->farValuesSize * sizeof(uint32_t);
+    size_t nodeColorsBytes = request.file->nodeColorsSize * sizeof(uint32_t);
+    operation->parts[0] = {operation, static_cast<uint8_t *>(request.gpuDataDst), gpuDataBytes, CHUNK_HEADER_SIZE};
+    operation->parts[1] = {
+        operation, static_cast<uint8_t *>(request.farValuesDst), farValuesBytes, CHUNK_HEADER_SIZE + gpuDataBytes
+    };
+    operation->parts[2] = {
+        operation, static_cast<uint8_t *>(request.nodeColorsDst), nodeColorsBytes, chunkNodeColorsOffset(*request.file)
+    };
+    bytesRead += gpuDataBytes + farValuesBytes + nodeColorsBytes;
+
+#ifdef USE_IO_URING
+    if (usingUring) {
+        uint32_t partCount = (gpuDataBytes > 0) + (farValuesBytes > 0) + (nodeColorsBytes > 0);
+        operation->partsLeft = partCount;
+        if (partCount == 0) {
+            completeOperation(operation);
+            return;
+        }
+        std::lock_guard<std::mutex> lock(ringMutex);
+        for (auto &part: operation->parts) {
+            if (part.remaining > 0) {
+                queuePart(&part);
+            }
+        }
+        io_uring_submit(&ring);
+        return;
+    }
+#endif
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        pending.push_back(operation);
+    }
+    pendingCv.notify_one();
+}
+
+size_t AsyncChunkReader::pollCompletions(std::vector<ChunkReadCompletion> &completions) {
+    std::lock_guard<std::mutex> lock(completionMutex);
+    size_t amount = completed.size();
+    completions.insert(completions.end(), completed.begin(), completed.end());
+    completed.clear();
+    return amount;
+}
+
+size_t AsyncChunkReader::waitForCompletions(std::vector<ChunkReadCompletion> &completions) {
+    std::unique_lock<std::mutex> lock(completionMutex);
+    completionCv.wait(lock, [this] { return !completed.empty() || inFlightCount.load() == 0; });
+    size_t amount = completed.size();
+    completions.insert(completions.end(), completed.begin(), completed.end());
+    completed.clear();
+    return amount;
+}
+
+bool AsyncChunkReader::hasCompletions() {
+    std::lock_guard<std::mutex> lock(completionMutex);
+    return !completed.empty();
+}
+
+void AsyncChunkReader::printStats() {
+    uint64_t reads = latencyHistogram.total();
+    spdlog::info("Chunk IO ({}): {} reads, {:.2f} MB, in flight {}/{}, depth p50 {} p99 {}, latency p50 {}us p99 {}us",
+                 usingUring ? "io_uring" : "threads", reads,
+                 static_cast<double>(bytesRead.exchange(0)) / (1024.0 * 1024.0), inFlightCount.load(), queueDepth,
+                 depthHistogram.percentile(0.5), depthHistogram.percentile(0.99),
+                 latencyHistogram.percentile(0.5), latencyHistogram.percentile(0.99));
+    depthHistogram.reset();
+    latencyHistogram.reset();
+}
+
+void AsyncChunkReader::workerLoop() {
+    while (true) {
+        ReadOperation *operation; {
+            std::unique_lock<std::mutex> lock(pendingMutex);
+            pendingCv.wait(lock, [this] { return stopFlag || !pending.empty(); });
+            if (stopFlag && pending.empty())
+                return;
+            operation = pending.front();
+            pending.pop_front();
+        }
+        operation->success = readChunkPayload(*operation->request.file, operation->request.gpuDataDst,
+                                               operation->request.farValuesDst, operation->request.nodeColorsDst);
+        completeOperation(operation);
+    }
+}
+
+void AsyncChunkReader::completeOperation(ReadOperation *operation) {
+    auto latency = std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - operation->submitted);
+    latencyHistogram.add(latency.count());
+    {
+        std::lock_guard<std::mutex> lock(completionMutex);
+        completed.push_back({operation->request.userData, operation->success.load()});
+    }
+    delete operation;
+    {
+        std::lock_guard<std::mutex> lock(capacityMutex);
+        inFlightCount--;
+    }
+    completionCv.notify_all();
+    capacityCv.notify_all();
+    if (completionListener) {
+        completionListener();
+    }
+}
+
+#ifdef USE_IO_URING
+void AsyncChunkReader::queuePart(ReadPart *part) {
+    //Caller holds ringMutex. The ring is sized for three reads per request, so there is always a free entry.
+    io_uring_sqe *sqe = io_uring_get_sqe(&ring);
+    auto length = static_cast<unsigned>(std::min<size_t>(part->remaining, 1u << 30));
+#ifdef _WIN32
+    int fd = -1;
+#else
+    int fd = part->operation->request.file->fd;
+#endif
+    io_uring_prep_read(sqe, fd, part->dst, length, part->offset);
+    io_uring_sqe_set_data(sqe, part);
+}
+
+void AsyncChunkReader::reaperLoop() {
+    while (true) {
+        io_uring_cqe *cqe;
+        int result = io_uring_wait_cqe(&ring, &cqe);
+        if (result == -EINTR) continue;
+        if (result < 0) {
+            spdlog::error("io_uring_wait_cqe failed: {}", result);
+            return;
+        }
+        auto *part = static_cast<ReadPart *>(io_uring_cqe_get_data(cqe));
+        int bytes = cqe->res;
+        io_uring_cqe_seen(&ring, cqe);
+        if (part == nullptr) {
+            return;
+        }
+
+        if (bytes == -EINTR || bytes == -EAGAIN) {
+            std::lock_guard<std::mutex> lock(ringMutex);
+            queuePart(part);
+            io_uring_submit(&ring);
+            continue;
+        }
+        if (bytes <= 0) {
+            part->operation->success = false;
+            part->remaining = 0;
+        } else {
+            part->dst += bytes;
+            part->offset += bytes;
+            part->remaining -= bytes;
+        }
+
+        if (part->remaining > 0) {
+            //Short read, queue the rest
+            std::lock_guard<std::mutex> lock(ringMutex);
+            queuePart(part);
+            io_uring_submit(&ring);
+            continue;
+        }
+
+        if (part->operation->partsLeft.fetch_sub(1) == 1) {
+            completeOperation(part->operation);
+        }
+    }
+}
+#endif
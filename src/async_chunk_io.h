@@ -0,0 +1,135 @@
+#pragma once
+
+#ifndef ASYNC_CHUNK_IO_H
+#define ASYNC_CHUNK_IO_H
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "chunk_management.h"
+
+#ifdef USE_IO_URING
+#include <liburing.h>
+#endif
+
+//Histogram with power of two buckets, bucket i counts the values in [2^(i-1), 2^i).
+struct Log2Histogram {
+    static constexpr size_t BUCKETS = 32;
+    std::array<std::atomic<uint64_t>, BUCKETS> counts{};
+
+    void add(uint64_t value);
+
+    uint64_t total() const;
+
+    //Upper bound of the bucket the given percentile (0-1) falls in.
+    uint64_t percentile(double p) const;
+
+    void reset();
+};
+
+struct ChunkReadRequest {
+    ChunkFile *file; //Has to stay open until the read is completed
+    void *gpuDataDst;
+    void *farValuesDst;
+    void *nodeColorsDst;
+    uint64_t userData;
+};
+
+struct ChunkReadCompletion {
+    uint64_t userData;
+    bool success;
+};
+
+//Keeps many chunk payload reads in flight at once, using io_uring when it is available and a pool of threads doing
+//blocking reads otherwise. Reads complete in whatever order the disk finishes them.
+class AsyncChunkReader {
+public:
+    AsyncChunkReader(uint32_t queueDepth, uint32_t threadCount);
+
+    ~AsyncChunkReader();
+
+    //Queue a read, blocks while queueDepth reads are already in flight.
+    void submit(const ChunkReadRequest &request);
+
+    //Move finished reads into completions without blocking, returns the amount added.
+    size_t pollCompletions(std::vector<ChunkReadCompletion> &completions);
+
+    //Block until at least one read finished, returns 0 straight away if nothing is in flight.
+    size_t waitForCompletions(std::vector<ChunkReadCompletion> &completions);
+
+    bool hasCompletions();
+
+    //Called after every finished read, from whatever thread finished it, so callers can wait for reads together with
+    //their other work. Set it before the first submit.
+    void setCompletionListener(std::function<void()> listener) { completionListener = std::move(listener); }
+
+    uint32_t inFlight() const { return inFlightCount.load(); }
+
+    uint32_t capacity() const { return queueDepth; }
+
+    //Log the queue depth and latency distribution since the previous call.
+    void printStats();
+
+private:
+    struct ReadOperation;
+
+    struct ReadPart {
+        ReadOperation *operation;
+        uint8_t *dst;
+        size_t remaining;
+        uint64_t offset;
+    };
+
+    struct ReadOperation {
+        ChunkReadRequest request;
+        std::chrono::steady_clock::time_point submitted;
+        std::array<ReadPart, 3> parts;
+        std::atomic<uint32_t> partsLeft;
+        std::atomic<bool> success;
+    };
+
+    uint32_t queueDepth;
+    std::atomic<uint32_t> inFlightCount = 0;
+    bool stopFlag = false;
+    bool usingUring = false;
+
+    std::mutex capacityMutex;
+    std::condition_variable capacityCv;
+
+    std::mutex completionMutex;
+    std::condition_variable completionCv;
+    std::vector<ChunkReadCompletion> completed;
+    std::function<void()> completionListener;
+
+    //Thread pool fallback
+    std::vector<std::thread> workers;
+    std::deque<ReadOperation *> pending;
+    std::mutex pendingMutex;
+    std::condition_variable pendingCv;
+
+#ifdef USE_IO_URING
+    io_uring ring{};
+    std::mutex ringMutex;
+    std::thread reaper;
+
+    void queuePart(ReadPart *part);
+
+    void reaperLoop();
+#endif
+
+    Log2Histogram depthHistogram;
+    Log2Histogram latencyHistogram; //In microseconds
+    std::atomic<uint64_t> bytesRead = 0;
+
+    void workerLoop();
+
+    void completeOperation(ReadOperation *operation);
+};
+
+#endif //ASYNC_CHUNK_IO_H
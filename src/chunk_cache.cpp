@@ -0,0 +1,68 @@
+#include "chunk_cache.h"
+
+#include "spdlog/spdlog.h"
+
+ChunkCache::ChunkCache(size_t maxBytes) : maxBytes(maxBytes) {
+}
+
+std::shared_ptr<const ChunkData> ChunkCache::get(const ChunkKey &key) {
+    if (!enabled()) return nullptr;
+    std::lock_guard<std::mutex> lock(mut);
+    auto it = entries.find(key);
+    if (it == entries.end()) {
+        misses++;
+        return nullptr;
+    }
+    hits++;
+    lru.splice(lru.begin(), lru, it->second.lruPosition);
+    return it->second.data;
+}
+
+bool ChunkCache::contains(const ChunkKey &key) {
+    if (!enabled()) return false;
+    std::lock_guard<std::mutex> lock(mut);
+    return entries.contains(key);
+}
+
+void ChunkCache::put(const ChunkKey &key, std::shared_ptr<const ChunkData> data) {
+    size_t bytes = data->bytes();
+    if (!enabled() || bytes > maxBytes) return;
+    std::lock_guard<std::mutex> lock(mut);
+    auto it = entries.find(key);
+    if (it != entries.end()) {
+        usedBytes -= it->second.data->bytes();
+        lru.erase(it->second.lruPosition);
+        entries.erase(it);
+    }
+    evictUntil(maxBytes - bytes);
+    lru.push_front(key);
+    entries.emplace(key, Entry{lru.begin(), std::move(data)});
+    usedBytes += bytes;
+}
+
+void ChunkCache::evictUntil(size_t bytes) {
+    while (usedBytes > bytes && !lru.empty()) {
+        auto it = entries.find(lru.back());
+        usedBytes -= it->second.data->bytes();
+        entries.erase(it);
+        lru.pop_back();
+        evictions++;
+    }
+}
+
+void ChunkCache::printStats() {
+    if (!enabled()) return;
+    uint64_t hitCount = hits.exchange(0);
+    uint64_t missCount = misses.exchange(0);
+    uint64_t lookups = hitCount + missCount;
+    size_t used, cached; {
+        std::lock_guard<std::mutex> lock(mut);
+        used = usedBytes;
+        cached = entries.size();
+    }
+    spdlog::info("Chunk cache: {} hits, {} misses ({:.1f}% hit rate), {} chunks, {:.2f}/{:.2f} MB, {} evictions",
+                 hitCount, missCount,
+                 lookups == 0 ? 0.0 : static_cast<double>(hitCount) / static_cast<double>(lookups) * 100.0,
+                 cached, static_cast<double>(used) / (1024.0 * 1024.0),
+                 static_cast<double>(maxBytes) / (1024.0 * 1024.0), evictions.load());
+}
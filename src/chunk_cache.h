@@ -0,0 +1,54 @@
+#pragma once
+
+#ifndef CHUNK_CACHE_H
+#define CHUNK_CACHE_H
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "chunk_management.h"
+
+//Keeps the decoded payload of recently used chunks in host memory, so moving back and forth over the same area does
+//not have to go to disk or generate the chunk again. Least recently used chunks are evicted once maxBytes is reached.
+class ChunkCache {
+public:
+    explicit ChunkCache(size_t maxBytes);
+
+    bool enabled() const { return maxBytes > 0; }
+
+    //Returns nullptr on a miss, a hit marks the chunk as most recently used.
+    std::shared_ptr<const ChunkData> get(const ChunkKey &key);
+
+    //Whether the chunk is cached, without counting as a lookup or touching its recency.
+    bool contains(const ChunkKey &key);
+
+    //Replaces the chunk if it was cached already. Chunks bigger than the whole cache are not stored.
+    void put(const ChunkKey &key, std::shared_ptr<const ChunkData> data);
+
+    //Log the hit rate since the previous call and the current usage.
+    void printStats();
+
+private:
+    struct Entry {
+        std::list<ChunkKey>::iterator lruPosition;
+        std::shared_ptr<const ChunkData> data;
+    };
+
+    size_t maxBytes;
+    size_t usedBytes = 0;
+    std::mutex mut;
+    //Front is the most recently used chunk
+    std::list<ChunkKey> lru;
+    std::unordered_map<ChunkKey, Entry, ChunkKeyHash> entries;
+
+    std::atomic<uint64_t> hits = 0;
+    std::atomic<uint64_t> misses = 0;
+    std::atomic<uint64_t> evictions = 0;
+
+    //Caller holds mut.
+    void evictUntil(size_t bytes);
+};
+
+#endif //CHUNK_CACHE_H
@@ -4,8 +4,11 @@
 
 #include "chunk_generation_application.h"
 
+#include <condition_variable>
 #include <format>
+#include <thread>
 
+#include "stb_image.h"
 #include "voxelizer.h"
 #include "spdlog/spdlog.h"
 namespace fs = std::filesystem;
@@ -30,8 +33,10 @@ ChunkGenerationApplication::ChunkGenerationApplication(Config config) : config(c
         (int) config.width, (int) config.height,
         config.fov, config
     );
+}
 
-    if (!config.useHeightmapData) {
+void ChunkGenerationApplication::loadScene() {
+    if (!config.useHeightmapData && !triangles) {
         float _scale;
         textures = std::map<std::string, LoadedTexture>();
         triangles = std::vector<TexturedTriangle>();
@@ -41,20 +46,10 @@ ChunkGenerationApplication::ChunkGenerationApplication(Config config) : config(c
     }
 }
 
-inline int positive_mod(const int a, const int b) {
-    return (a % b + b) % b;
-}
-
-// Computes discrete LOD level based on distance
-inline uint32_t computeLOD(float distance) {
-    distance = std::max(distance, 1.0f); // avoid log2(0)
-    return static_cast<uint32_t>(std::floor(std::log2(distance)));
-}
-
-inline uint32_t calculateChunkResolution(uint32_t maxChunkResolution, float distance) {
-    uint32_t lod = computeLOD(distance);
-    uint32_t resolution = maxChunkResolution >> lod; // divide by 2^lod
-    return std::min(1024u, std::max(resolution, 8u)); // clamp to some minimum
+ChunkGenWorker::~ChunkGenWorker() {
+    for (const auto &[key, value]: textures) {
+        stbi_image_free(value.imageData);
+    }
 }
 
 inline bool sceneInChunk(const Aabb &scene, const Aabb &chunk, const float &scale) {
@@ -68,101 +63,189 @@ inline bool sceneInChunk(const Aabb &scene, const Aabb &chunk, const float &scal
     );
 }
 
-void ChunkGenerationApplication::generateChunk(glm::ivec3 gridCoord, uint32_t resolution, glm::ivec3 chunkCoord) {
+bool ChunkGenerationApplication::generateChunk(const ChunkKey &job, ChunkGenWorker &worker) {
+    const uint32_t resolution = job.resolution;
+    const glm::ivec3 chunkCoord = job.chunkCoord;
     uint32_t nodeAmount = 0;
     auto chunkFarValues = std::vector<uint32_t>();
     auto chunkOctreeGPU = std::vector<uint32_t>();
-    if (!loadChunk(directory, config.chunk_resolution, resolution, chunkCoord, nodeAmount, chunkOctreeGPU,
-                   chunkFarValues)) {
-        // spdlog::debug("Chunk not yet created, generating the chunk");
-        auto aabb = Aabb{};
-        aabb.aa = glm::ivec3(chunkCoord.x * config.chunk_resolution, chunkCoord.y * config.chunk_resolution,
-                             chunkCoord.z * config.chunk_resolution);
-        aabb.bb = glm::ivec3(aabb.aa.x + config.chunk_resolution, aabb.aa.y + config.chunk_resolution,
-                             aabb.aa.z + config.chunk_resolution);
-        uint32_t maxDepth = std::ceil(std::log2(resolution));
-
-        std::optional<OctreeNode> node = std::nullopt;
-        if (config.useHeightmapData) {
-            node = createChunkOctree(resolution, config.seed, chunkCoord, config.chunk_resolution, config.voxelscale,
-                                     config.grid_height,
-                                     nodeAmount);
-        } else if (sceneInChunk(objSceneMetaData->sceneAabb, aabb, objSceneMetaData->scale)) {
-            std::vector<uint32_t> allIndices(triangles.value().size());
-            std::iota(allIndices.begin(), allIndices.end(), 0);
-            node = createNode(aabb, triangles.value(), allIndices, textures.value(), nodeAmount, maxDepth, 0, objSceneMetaData.value());
+    auto chunkNodeColors = std::vector<uint32_t>();
+    uint32_t treeLevels = 0;
+    //The streaming application may have written the chunk since the manifest was made.
+    if (fs::exists(chunkFilePath(directory, config.chunk_resolution, resolution, chunkCoord))) {
+        return true;
+    }
+
+    // spdlog::debug("Chunk not yet created, generating the chunk");
+    auto aabb = Aabb{};
+    aabb.aa = glm::ivec3(chunkCoord.x * config.chunk_resolution, chunkCoord.y * config.chunk_resolution,
+                         chunkCoord.z * config.chunk_resolution);
+    aabb.bb = glm::ivec3(aabb.aa.x + config.chunk_resolution, aabb.aa.y + config.chunk_resolution,
+                         aabb.aa.z + config.chunk_resolution);
+    uint32_t maxDepth = std::ceil(std::log2(resolution));
+
+    std::optional<OctreeNode> node = std::nullopt;
+    if (config.useHeightmapData) {
+        //Builds its own noise generator, so this is safe to call from every worker.
+        node = createChunkOctree(resolution, config.seed, chunkCoord, config.chunk_resolution, config.voxelscale,
+                                 config.grid_height,
+                                 nodeAmount);
+    } else if (sceneInChunk(objSceneMetaData->sceneAabb, aabb, objSceneMetaData->scale)) {
+        //The triangles are only read, the index list and textures are the worker's own.
+        if (worker.allIndices.size() != triangles.value().size()) {
+            worker.allIndices.resize(triangles.value().size());
+            std::iota(worker.allIndices.begin(), worker.allIndices.end(), 0);
         }
+        node = createNode(aabb, triangles.value(), worker.allIndices, worker.textures, nodeAmount, maxDepth, 0,
+                          objSceneMetaData.value());
+    }
 
 
-        if (node) {
-            auto shared_node = std::make_shared<OctreeNode>(*node);
-            addOctreeGPUdataBF(chunkOctreeGPU, shared_node, nodeAmount, chunkFarValues);
-            if (!saveChunk(directory, config.chunk_resolution, resolution, chunkCoord, nodeAmount,
-                           chunkOctreeGPU, chunkFarValues)) {
-                std::cout << "Something went wrong storing Chunk data" << std::endl;
-            }
-        } else {
-            saveChunk(directory, config.chunk_resolution, resolution, chunkCoord, nodeAmount,
-                      chunkOctreeGPU, chunkFarValues);
+    if (node) {
+        auto shared_node = std::make_shared<OctreeNode>(*node);
+        addOctreeGPUdataBF(chunkOctreeGPU, shared_node, nodeAmount, chunkFarValues);
+        //Stored with the chunk, so the streamer can change its LOD in place without computing them after every read
+        treeLevels = breadthFirstNodeColors(chunkOctreeGPU, chunkFarValues, chunkNodeColors);
+        if (!saveChunk(directory, config.chunk_resolution, resolution, chunkCoord, nodeAmount,
+                       chunkOctreeGPU, chunkFarValues, chunkNodeColors, treeLevels)) {
+            std::cout << "Something went wrong storing Chunk data" << std::endl;
+            return false;
         }
+    } else {
+        return saveChunk(directory, config.chunk_resolution, resolution, chunkCoord, nodeAmount,
+                         chunkOctreeGPU, chunkFarValues, chunkNodeColors, treeLevels);
     }
+    return true;
 }
 
-void ChunkGenerationApplication::generateChunksForCameraPosition() {
-    auto center = camera.gpu_camera.camera_grid_pos;
-    glm::ivec3 start = center - int((camera.gridSize - 1) / 2);
-    spdlog::info("Generating {} Chunks!", camera.gridHeight * camera.gridSize * camera.gridSize);
-    for (int chunkZ = 0; chunkZ < camera.gridHeight; chunkZ++) {
-        for (int chunkY = start.y; chunkY < camera.gridSize; chunkY++) {
-            for (int chunkX = start.x; chunkX < camera.gridSize; chunkX++) {
-                auto gridCoord = glm::ivec3{
-                    positive_mod(chunkX, camera.gridSize), positive_mod(chunkY, camera.gridSize), chunkZ
-                };
-                glm::ivec3 dist = glm::ivec3(chunkX, chunkY, chunkZ) - center;
-                glm::vec3 worldDiff = glm::vec3(dist) * (
-                                          static_cast<float>(config.chunk_resolution) * config.voxelscale);
-                float distance = glm::length(worldDiff) - (
-                                     static_cast<float>(config.chunk_resolution) * config.voxelscale);;
-                uint32_t octreeResolution = calculateChunkResolution(config.chunk_resolution, distance / config.scaleDistance);
-
-                //The cpu chunks location, so not the buffer location we store it in, which is gridCoord, but the coords of the chunk itself.
-                glm::ivec3 chunkCoord = camera.chunk_coords + dist;
-                generateChunk(gridCoord, octreeResolution, chunkCoord);
+void ChunkGenerationApplication::generateChunks(const std::vector<ChunkKey> &jobs, ChunkManifest &manifest) {
+    uint32_t threadCount = config.chunkgenThreads != 0
+                               ? config.chunkgenThreads
+                               : std::max(std::thread::hardware_concurrency(), 1u);
+    threadCount = std::min<uint32_t>(threadCount, std::max<size_t>(jobs.size(), 1));
+
+    std::atomic<size_t> nextJob = 0;
+    std::atomic<size_t> finishedJobs = 0;
+    std::mutex progressMutex;
+    std::condition_variable progressCv;
+
+    std::vector<std::thread> workers;
+    for (uint32_t i = 0; i < threadCount; i++) {
+        workers.emplace_back([&]() {
+            ChunkGenWorker worker;
+            for (size_t job = nextJob++; job < jobs.size(); job = nextJob++) {
+                if (generateChunk(jobs[job], worker)) {
+                    manifest.add(jobs[job]);
+                }
+                if (++finishedJobs == jobs.size()) {
+                    std::lock_guard<std::mutex> lock(progressMutex);
+                    progressCv.notify_all();
+                }
             }
+        });
+    }
+
+    auto startTime = std::chrono::steady_clock::now();
+    {
+        std::unique_lock<std::mutex> lock(progressMutex);
+        while (!progressCv.wait_for(lock, std::chrono::seconds(1),
+                                    [&] { return finishedJobs.load() == jobs.size(); })) {
+            size_t finished = finishedJobs.load();
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+            double chunksPerSecond = static_cast<double>(finished) / seconds;
+            double eta = chunksPerSecond > 0.0 ? static_cast<double>(jobs.size() - finished) / chunksPerSecond : 0.0;
+            spdlog::info("Chunkgen: {}/{} chunks ({:.1f}%), {:.1f} chunks/s, ETA {:.0f}s", finished, jobs.size(),
+                         static_cast<double>(finished) / static_cast<double>(jobs.size()) * 100.0, chunksPerSecond,
+                         eta);
         }
     }
+    for (auto &worker: workers) {
+        worker.join();
+    }
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    spdlog::info("Generated {} chunks in {:.2f}s on {} threads ({:.1f} chunks/s)", jobs.size(), seconds, threadCount,
+                 seconds > 0.0 ? static_cast<double>(jobs.size()) / seconds : 0.0);
+}
+
+std::vector<glm::ivec3> ChunkGenerationApplication::collectCameraChunks() {
+    if (!config.cameraKeyFrames) {
+        return {camera.chunk_coords};
+    }
+    std::vector<glm::ivec3> cameraChunks;
+    std::unordered_set<ChunkKey, ChunkKeyHash> seen;
+    const auto start = config.cameraKeyFrames.value().front().time;
+    const auto end = config.cameraKeyFrames.value().back().time;
+    constexpr float timeBetweenFrames = (1.0 / 60.0);
+    for (float t = start; t < (end + timeBetweenFrames); t += timeBetweenFrames) {
+        auto kf = interpolateCamera(config.cameraKeyFrames.value(), t);
+        if (!config.useHeightmapData) {
+            camera.setPosition(kf.position * objSceneMetaData->scale);
+        } else {
+            camera.setPosition(kf.position);
+        }
+        if (seen.insert({camera.chunk_coords, 0}).second) {
+            cameraChunks.push_back(camera.chunk_coords);
+        }
+    }
+    return cameraChunks;
 }
 
 void ChunkGenerationApplication::genererateChunks() {
-    if (config.cameraKeyFrames) {
-        std::vector<std::string> computed_chunks = {};
-        const auto start = config.cameraKeyFrames.value().front().time;
-        const auto end = config.cameraKeyFrames.value().back().time;
-        constexpr float timeBetweenFrames = (1.0 / 60.0);
-        for (float t = start; t < (end + timeBetweenFrames); t += timeBetweenFrames) {
-            auto kf = interpolateCamera(config.cameraKeyFrames.value(), t);
-            if (!config.useHeightmapData) {
-                camera.setPosition(kf.position * objSceneMetaData->scale);
-            } else {
-                camera.setPosition(kf.position);
-            }
-            const std::string key = std::format("{}, {}, {}", camera.chunk_coords.x, camera.chunk_coords.y, camera.chunk_coords.z);
-            bool already_computed = false;
-            for (const auto &computed_chunk : computed_chunks)
-            {
-                if (computed_chunk == key)
-                {
-                    already_computed = true;
-                    break;
-                }
-            }
-            if (already_computed) {continue;}
-            computed_chunks.push_back(key);
-            spdlog::info("Generating Chunks around Camera chunk: {}", key);
-            camera.gpu_camera.direction = glm::normalize(kf.direction);
-            generateChunksForCameraPosition();
+    ChunkManifest manifest(directory, config.chunk_resolution);
+    bool rebuilt = manifest.load();
+    //A shard records what it generated in a manifest of its own, so shards never write the same file.
+    bool sharded = config.shardCount > 1;
+    ChunkManifest shardManifest(directory, config.chunk_resolution,
+                                ChunkManifest::shardFileName(config.shardIndex, config.shardCount));
+    if (sharded) {
+        //Resume from a previous run of this shard
+        shardManifest.mergeFile(shardManifest.path());
+        manifest.merge(shardManifest);
+    }
+
+    ChunkPlan plan = planChunks(collectCameraChunks(), config, manifest);
+    if (sharded) {
+        plan.keepShard(config.shardIndex, config.shardCount);
+        spdlog::info("Shard {}/{}", config.shardIndex, config.shardCount);
+    }
+    plan.print();
+    if (config.chunkgenPlanOnly || plan.missing.empty()) {
+        //Keep a rebuilt manifest anyway, so the next run does not scan again. Shards leave the shared manifest to
+        //--merge-shards.
+        if (rebuilt && !sharded && !manifest.save()) {
+            spdlog::error("Failed to write chunk manifest {}", manifest.path().string());
         }
-    } else {
-        generateChunksForCameraPosition();
+        return;
+    }
+
+    loadScene();
+    ChunkManifest &output = sharded ? shardManifest : manifest;
+    generateChunks(plan.missing, output);
+    if (!output.save()) {
+        spdlog::error("Failed to write chunk manifest {}", output.path().string());
+    }
+}
+
+void ChunkGenerationApplication::mergeShards() {
+    ChunkManifest manifest(directory, config.chunk_resolution);
+    manifest.load();
+    size_t before = manifest.size();
+    std::vector<fs::path> shardFiles = manifest.shardFiles();
+    for (const auto &shardFile: shardFiles) {
+        if (!manifest.mergeFile(shardFile)) {
+            spdlog::error("Failed to read shard manifest {}", shardFile.string());
+            return;
+        }
+    }
+    if (!manifest.save()) {
+        spdlog::error("Failed to write chunk manifest {}", manifest.path().string());
+        return;
+    }
+    //Only remove the shard manifests once everything is in the merged one.
+    for (const auto &shardFile: shardFiles) {
+        fs::remove(shardFile);
     }
+    spdlog::info("Merged {} shard manifests, {} new chunks, {} chunks in total", shardFiles.size(),
+                 manifest.size() - before, manifest.size());
 }
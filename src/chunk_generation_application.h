@@ -4,21 +4,43 @@
 
 #ifndef CHUNK_GENERATION_APPLICATION_H
 #define CHUNK_GENERATION_APPLICATION_H
+#include "chunk_planner.h"
 #include "config.h"
 #include "scene_metadata.h"
 #include "structures.h"
 
 
+//State every chunkgen worker keeps for itself, so workers never share anything they write to.
+struct ChunkGenWorker {
+    //Textures get loaded lazily by the voxelizer
+    std::map<std::string, LoadedTexture> textures;
+    std::vector<uint32_t> allIndices;
+
+    ~ChunkGenWorker();
+};
+
 class ChunkGenerationApplication {
 public:
     explicit ChunkGenerationApplication(Config config);
 
-    void generateChunk(glm::ivec3 gridCoord, uint32_t resolution, glm::ivec3 chunkCoord);
+    //Returns false if the chunk could not be stored.
+    bool generateChunk(const ChunkKey &job, ChunkGenWorker &worker);
 
-    void generateChunksForCameraPosition();
+    //Generate the jobs on config.chunkgenThreads workers, printing progress every second.
+    //Every chunk that got stored is added to the manifest.
+    void generateChunks(const std::vector<ChunkKey> &jobs, ChunkManifest &manifest);
+
+    //The chunks the camera is in along the keyframe path, each only once.
+    std::vector<glm::ivec3> collectCameraChunks();
 
     void genererateChunks();
 
+    //Combine the manifests written by chunkgen shards into the scene manifest.
+    void mergeShards();
+
+    //Only needed when there are chunks to generate
+    void loadScene();
+
 
     Config config;
     CPUCamera camera;
@@ -5,27 +5,64 @@
 #include <fstream>
 #include <iostream>
 #include <format>
+#include <algorithm>
+#include <thread>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <glm/gtc/constants.hpp>
 
 #include "chunk_management.h"
 
+ChunkFile::~ChunkFile() {
+    close();
+}
+
+void ChunkFile::close() {
+#ifdef _WIN32
+    if (stream.is_open()) {
+        stream.close();
+    }
+#else
+    if (fd >= 0) {
+        ::close(fd);
+        fd = -1;
+    }
+#endif
+}
+
+std::filesystem::path chunkFilePath(const std::string &scenePath, uint32_t max_resolution, uint32_t svo_resolution,
+                                    glm::ivec3 gridCoords) {
+    namespace fs = std::filesystem;
+    fs::path dirPath(scenePath);
+    auto max_resolution_string = std::format("max_scene_resolution_{}", max_resolution);
+    auto chunk_resolution_string = std::format("chunk_resolution_{}", svo_resolution);
+    auto file_name = std::format("x{},y{},z{}.svo", gridCoords.x, gridCoords.y, gridCoords.z);
+    return dirPath / max_resolution_string / chunk_resolution_string / file_name;
+}
+
 bool saveChunk(const std::string &scenePath, uint32_t max_resolution, uint32_t svo_resolution, glm::ivec3 gridCoords,
-               uint32_t &nodeCount,
-               std::vector<uint32_t> &gpuData, std::vector<uint32_t> &farValues) {
+               uint32_t nodeCount,
+               const std::vector<uint32_t> &gpuData, const std::vector<uint32_t> &farValues,
+               const std::vector<uint32_t> &nodeColors, uint32_t treeLevels) {
     namespace fs = std::filesystem;
 
     try {
-        fs::path dirPath(scenePath);
-        auto max_resolution_string = std::format("max_scene_resolution_{}", max_resolution);
-        auto chunk_resolution_string = std::format("chunk_resolution_{}", svo_resolution);
-        auto file_name = std::format("x{},y{},z{}.svo", gridCoords.x, gridCoords.y, gridCoords.z);
-        fs::path fullDirPath = dirPath / max_resolution_string / chunk_resolution_string;
-        fs::create_directories(fullDirPath);
-        fs::path filePath = fullDirPath / file_name;
-
-        std::ofstream outFile(filePath, std::ios::binary);
+        fs::path filePath = chunkFilePath(scenePath, max_resolution, svo_resolution, gridCoords);
+        fs::create_directories(filePath.parent_path());
+
+        //Write to a file of our own first and move it in place after, so concurrent writers and readers never see a
+        //half written chunk.
+        fs::path tempPath = filePath;
+        tempPath += std::format(".{}.tmp", std::hash<std::thread::id>{}(std::this_thread::get_id()));
+        std::ofstream outFile(tempPath, std::ios::binary);
         if (!outFile) return false;
         // Write metadata
-        outFile.write(reinterpret_cast<char *>(&nodeCount), sizeof(nodeCount));
+        outFile.write(reinterpret_cast<const char *>(&nodeCount), sizeof(nodeCount));
         //Write Vector sizes to interpret reset of file
         uint32_t gpuDataSize = gpuData.size();
         uint32_t farValuesSize = farValues.size();
@@ -33,10 +70,21 @@ bool saveChunk(const std::string &scenePath, uint32_t max_resolution, uint32_t s
         outFile.write(reinterpret_cast<char *>(&farValuesSize), sizeof(farValuesSize));
 
         // Write vectors
-        outFile.write(reinterpret_cast<char *>(gpuData.data()), gpuDataSize * sizeof(uint32_t));
-        outFile.write(reinterpret_cast<char *>(farValues.data()), farValuesSize * sizeof(uint32_t));
+        outFile.write(reinterpret_cast<const char *>(gpuData.data()), gpuDataSize * sizeof(uint32_t));
+        outFile.write(reinterpret_cast<const char *>(farValues.data()), farValuesSize * sizeof(uint32_t));
+
+        //The node colors come last, so files without them can still be read
+        uint32_t nodeColorsSize = nodeColors.size();
+        outFile.write(reinterpret_cast<char *>(&nodeColorsSize), sizeof(nodeColorsSize));
+        outFile.write(reinterpret_cast<char *>(&treeLevels), sizeof(treeLevels));
+        outFile.write(reinterpret_cast<const char *>(nodeColors.data()), nodeColorsSize * sizeof(uint32_t));
 
         outFile.close();
+        if (!outFile) {
+            fs::remove(tempPath);
+            return false;
+        }
+        fs::rename(tempPath, filePath);
         return true;
     } catch (...) {
         return false;
@@ -46,17 +94,12 @@ bool saveChunk(const std::string &scenePath, uint32_t max_resolution, uint32_t s
 
 bool loadChunk(const std::string &scenePath, uint32_t max_resolution, uint32_t svo_resolution, glm::ivec3 gridCoords,
                uint32_t &nodeCount,
-               std::vector<uint32_t> &gpuData, std::vector<uint32_t> &farValues) {
+               std::vector<uint32_t> &gpuData, std::vector<uint32_t> &farValues,
+               std::vector<uint32_t> &nodeColors, uint32_t &treeLevels) {
     namespace fs = std::filesystem;
 
     try {
-        fs::path dirPath(scenePath);
-        auto max_resolution_string = std::format("max_scene_resolution_{}", max_resolution);
-        auto chunk_resolution_string = std::format("chunk_resolution_{}", svo_resolution);
-        auto file_name = std::format("x{},y{},z{}.svo", gridCoords.x, gridCoords.y, gridCoords.z);
-        fs::path fullDirPath = dirPath / max_resolution_string / chunk_resolution_string;
-        fs::create_directories(fullDirPath);
-        fs::path filePath = fullDirPath / file_name;
+        fs::path filePath = chunkFilePath(scenePath, max_resolution, svo_resolution, gridCoords);
 
         std::ifstream outFile(filePath, std::ios::binary);
         if (!outFile) return false;
@@ -78,6 +121,21 @@ bool loadChunk(const std::string &scenePath, uint32_t max_resolution, uint32_t s
         outFile.read(reinterpret_cast<char *>(farValues.data() + old_far_values_size),
                      farValuesSize * sizeof(uint32_t));
 
+        //Older files end here
+        uint32_t colorsHeader[2];
+        if (outFile.read(reinterpret_cast<char *>(colorsHeader), CHUNK_COLORS_HEADER_SIZE)) {
+            nodeColors.resize(colorsHeader[0]);
+            treeLevels = colorsHeader[1];
+            outFile.read(reinterpret_cast<char *>(nodeColors.data()), colorsHeader[0] * sizeof(uint32_t));
+            if (!outFile) {
+                nodeColors.clear();
+                treeLevels = 0;
+            }
+        } else {
+            nodeColors.clear();
+            treeLevels = 0;
+        }
+
         outFile.close();
 
         return true;
@@ -85,3 +143,163 @@ bool loadChunk(const std::string &scenePath, uint32_t max_resolution, uint32_t s
         return false;
     }
 }
+
+#ifndef _WIN32
+//pread can return less than requested, keep reading until everything is in or the file ends early.
+static bool preadFully(int fd, void *dst, size_t size, off_t offset) {
+    auto *out = static_cast<uint8_t *>(dst);
+    while (size > 0) {
+        ssize_t bytesRead = pread(fd, out, size, offset);
+        if (bytesRead < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytesRead <= 0) {
+            return false;
+        }
+        out += bytesRead;
+        size -= bytesRead;
+        offset += bytesRead;
+    }
+    return true;
+}
+#endif
+
+bool openChunk(const std::string &scenePath, uint32_t max_resolution, uint32_t svo_resolution, glm::ivec3 gridCoords,
+               ChunkFile &file) {
+    file.close();
+    try {
+        std::filesystem::path filePath = chunkFilePath(scenePath, max_resolution, svo_resolution, gridCoords);
+        uint32_t header[3];
+        uint32_t colorsHeader[2] = {0, 0};
+#ifdef _WIN32
+        file.stream.open(filePath, std::ios::binary);
+        if (!file.stream) return false;
+        if (!file.stream.read(reinterpret_cast<char *>(header), CHUNK_HEADER_SIZE)) {
+            file.close();
+            return false;
+        }
+        //Files written before the node colors were stored end after the far values
+        file.stream.seekg(CHUNK_HEADER_SIZE + (static_cast<uint64_t>(header[1]) + header[2]) * sizeof(uint32_t));
+        if (!file.stream.read(reinterpret_cast<char *>(colorsHeader), CHUNK_COLORS_HEADER_SIZE)) {
+            colorsHeader[0] = colorsHeader[1] = 0;
+            file.stream.clear();
+        }
+#else
+        file.fd = ::open(filePath.c_str(), O_RDONLY);
+        if (file.fd < 0) return false;
+        if (!preadFully(file.fd, header, CHUNK_HEADER_SIZE, 0)) {
+            file.close();
+            return false;
+        }
+        //Files written before the node colors were stored end after the far values
+        if (!preadFully(file.fd, colorsHeader, CHUNK_COLORS_HEADER_SIZE,
+                        CHUNK_HEADER_SIZE + (static_cast<off_t>(header[1]) + header[2]) * sizeof(uint32_t))) {
+            colorsHeader[0] = colorsHeader[1] = 0;
+        }
+#endif
+        file.nodeCount = header[0];
+        file.gpuDataSize = header[1];
+        file.farValuesSize = header[2];
+        file.nodeColorsSize = colorsHeader[0];
+        file.treeLevels = colorsHeader[1];
+        return true;
+    } catch (...) {
+        file.close();
+        return false;
+    }
+}
+
+bool readChunkPayload(ChunkFile &file, void *gpuDataDst, void *farValuesDst, void *nodeColorsDst) {
+    size_t gpuDataBytes = file.gpuDataSize * sizeof(uint32_t);
+    size_t farValuesBytes = file.farValuesSize * sizeof(uint32_t);
+    size_t nodeColorsBytes = file.nodeColorsSize * sizeof(uint32_t);
+#ifdef _WIN32
+    if (!file.stream.is_open()) return false;
+    file.stream.seekg(CHUNK_HEADER_SIZE);
+    if (gpuDataBytes > 0 && !file.stream.read(static_cast<char *>(gpuDataDst), gpuDataBytes)) return false;
+    if (farValuesBytes > 0 && !file.stream.read(static_cast<char *>(farValuesDst), farValuesBytes)) return false;
+    file.stream.seekg(chunkNodeColorsOffset(file));
+    if (nodeColorsBytes > 0 && !file.stream.read(static_cast<char *>(nodeColorsDst), nodeColorsBytes)) return false;
+#else
+    if (file.fd < 0) return false;
+    if (gpuDataBytes > 0 && !preadFully(file.fd, gpuDataDst, gpuDataBytes, CHUNK_HEADER_SIZE)) return false;
+    if (farValuesBytes > 0 && !preadFully(file.fd, farValuesDst, farValuesBytes,
+                                          CHUNK_HEADER_SIZE + gpuDataBytes)) {
+        return false;
+    }
+    if (nodeColorsBytes > 0 && !preadFully(file.fd, nodeColorsDst, nodeColorsBytes, chunkNodeColorsOffset(file))) {
+        return false;
+    }
+#endif
+    return true;
+}
+
+LodShellTable::LodShellTable(uint32_t gridSize, uint32_t gridHeight, uint32_t maxChunkResolution,
+                             const ScreenSpaceError &error, float lodHysteresis)
+    : radius(static_cast<int>((gridSize - 1) / 2)), gridSize(static_cast<int>(gridSize)),
+      gridHeight(static_cast<int>(gridHeight)) {
+    //The camera can be in any layer, so every layer offset it can see
+    for (int dz = -(this->gridHeight - 1); dz < this->gridHeight; dz++) {
+        for (int dy = -radius; dy <= radius; dy++) {
+            for (int dx = -radius; dx <= radius; dx++) {
+                glm::ivec3 offset(dx, dy, dz);
+                auto [coarsest, finest] = chunkResolutionBand(offset, maxChunkResolution, error, lodHysteresis);
+                cells.push_back({
+                    offset, chunkResolutionForOffset(offset, maxChunkResolution, error), coarsest, finest
+                });
+            }
+        }
+    }
+    std::stable_sort(cells.begin(), cells.end(), [](const LodShellCell &a, const LodShellCell &b) {
+        auto shell = [](glm::ivec3 offset) {
+            return std::max({std::abs(offset.x), std::abs(offset.y), std::abs(offset.z)});
+        };
+        return shell(a.offset) < shell(b.offset);
+    });
+    cellIndex.resize(cells.size());
+    for (uint32_t i = 0; i < cells.size(); i++) {
+        cellIndex[denseIndex(cells[i].offset)] = i;
+    }
+}
+
+size_t LodShellTable::denseIndex(glm::ivec3 offset) const {
+    size_t width = 2 * radius + 1;
+    return (static_cast<size_t>(offset.z + gridHeight - 1) * width + (offset.y + radius)) * width + (offset.x + radius);
+}
+
+const LodShellCell *LodShellTable::find(glm::ivec3 offset) const {
+    if (std::abs(offset.x) > radius || std::abs(offset.y) > radius || std::abs(offset.z) >= gridHeight) {
+        return nullptr;
+    }
+    return &cells[cellIndex[denseIndex(offset)]];
+}
+
+glm::ivec3 LodShellTable::offsetOf(glm::ivec3 gridCoord, glm::ivec3 cameraGridCoord) const {
+    auto wrapped = [this](int from, int to) {
+        int offset = ((to - from) % gridSize + gridSize) % gridSize;
+        return offset > radius ? offset - gridSize : offset;
+    };
+    return {
+        wrapped(cameraGridCoord.x, gridCoord.x), wrapped(cameraGridCoord.y, gridCoord.y),
+        gridCoord.z - cameraGridCoord.z
+    };
+}
+
+ViewCone::ViewCone(glm::vec3 cameraPosition, glm::vec3 direction, float verticalFov, float aspect, float guardRadians)
+    : position(cameraPosition), direction(glm::normalize(direction)) {
+    //The screen corners are the furthest from the view direction
+    float tanHalf = std::tan(verticalFov * 0.5f);
+    halfAngle = std::atan(tanHalf * std::sqrt(1.0f + aspect * aspect)) + guardRadians;
+}
+
+bool ViewCone::contains(glm::ivec3 offset) const {
+    //Bounding sphere of the chunk
+    constexpr float radius = 0.8660254f;
+    glm::vec3 toChunk = glm::vec3(offset) + 0.5f - position;
+    float distance = glm::length(toChunk);
+    if (distance <= radius || halfAngle >= glm::pi<float>()) {
+        return true;
+    }
+    float angle = std::acos(std::clamp(glm::dot(toChunk / distance, direction), -1.0f, 1.0f));
+    return angle - std::asin(radius / distance) <= halfAngle;
+}
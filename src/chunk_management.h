@@ -12,13 +12,215 @@
 // #include "data_manage_threat.h"
 #include "structures.h"
 
+//Size of the header in front of every chunk file, nodeCount, gpuDataSize and farValuesSize.
+constexpr size_t CHUNK_HEADER_SIZE = 3 * sizeof(uint32_t);
+
+//Size of the header in front of the node colors, which follow the far values: nodeColorsSize and treeLevels. Files
+//written before the colors were stored end after the far values.
+constexpr size_t CHUNK_COLORS_HEADER_SIZE = 2 * sizeof(uint32_t);
+
+//Coarsest resolution a grid chunk gets loaded at
+constexpr uint32_t MIN_CHUNK_RESOLUTION = 8;
+
+//How big voxels end up on screen. A voxel of size s at distance d covers s / (d * pixelAngle) pixels in the middle of
+//the screen, and less towards the edges, so that is what has to stay below pixelError.
+struct ScreenSpaceError {
+    //World size of a voxel at the max resolution
+    float voxelScale;
+    //Radians a pixel covers in the middle of the screen
+    float pixelAngle;
+    float pixelError;
+
+    ScreenSpaceError(float voxelScale, float verticalFov, uint32_t screenHeight, float pixelError)
+        : voxelScale(voxelScale), pixelAngle(2.0f * std::tan(verticalFov * 0.5f) / static_cast<float>(screenHeight)),
+          pixelError(pixelError) {
+    }
+
+    //The camera the application renders with, streaming and chunkgen both use this so they agree on the resolutions.
+    explicit ScreenSpaceError(const Config &config)
+        : ScreenSpaceError(config.voxelscale, config.fov, config.height, config.pixelError) {
+    }
+
+    //LOD levels below the max resolution that still keep voxels at distance within pixelError
+    uint32_t lodAt(float distance) const {
+        float allowed = std::max(distance, 0.0f) * pixelAngle * pixelError / voxelScale;
+        return static_cast<uint32_t>(std::floor(std::log2(std::clamp(allowed, 1.0f, 2147483648.0f))));
+    }
+
+    ScreenSpaceError withPixelError(float error) const {
+        ScreenSpaceError scaled = *this;
+        scaled.pixelError = error;
+        return scaled;
+    }
+};
+
+//Coarsest chunk resolution (in voxels per edge) whose voxels stay below the pixel error at distance
+inline uint32_t calculateChunkResolution(uint32_t maxResolution, float distance, const ScreenSpaceError &error) {
+    uint32_t resolution = maxResolution >> std::min(error.lodAt(distance), 31u);
+    return std::min(1024u, std::max(resolution, MIN_CHUNK_RESOLUTION)); // clamp to some minimum
+}
+
+//Resolution of a chunk that is offset chunks away from the camera chunk, streaming and chunkgen both use this so they
+//always agree on which files are needed.
+inline uint32_t chunkResolutionForOffset(glm::ivec3 offset, uint32_t maxChunkResolution,
+                                         const ScreenSpaceError &error) {
+    //The camera can be anywhere in its chunk, so measure to the nearest point the chunk can have
+    glm::vec3 worldDiff = glm::vec3(glm::abs(offset)) * (static_cast<float>(maxChunkResolution) * error.voxelScale);
+    float distance = glm::length(worldDiff) - (static_cast<float>(maxChunkResolution) * error.voxelScale);
+    return calculateChunkResolution(maxChunkResolution, distance, error);
+}
+
+//Resolutions a chunk at offset is allowed to keep, lodHysteresis being how many LOD levels it may be off before it
+//has to be reloaded. Returns the coarsest and finest one, chunkgen generates everything in between.
+inline std::pair<uint32_t, uint32_t> chunkResolutionBand(glm::ivec3 offset, uint32_t maxChunkResolution,
+                                                         const ScreenSpaceError &error, float lodHysteresis) {
+    float scale = std::exp2(std::max(lodHysteresis, 0.0f));
+    return {
+        chunkResolutionForOffset(offset, maxChunkResolution, error.withPixelError(error.pixelError * scale)),
+        chunkResolutionForOffset(offset, maxChunkResolution, error.withPixelError(error.pixelError / scale))
+    };
+}
+
+//Cone around the view direction that holds the whole screen plus a guard band, to tell which chunks primary rays can
+//reach. Positions are in chunks, relative to the corner of the camera chunk.
+class ViewCone {
+public:
+    ViewCone(glm::vec3 cameraPosition, glm::vec3 direction, float verticalFov, float aspect, float guardRadians);
+
+    //Whether any part of the chunk at offset from the camera chunk is inside the cone.
+    bool contains(glm::ivec3 offset) const;
+
+private:
+    glm::vec3 position;
+    glm::vec3 direction;
+    float halfAngle;
+};
+
+//A grid cell relative to the camera chunk, with the resolutions it gets loaded at and may keep.
+struct LodShellCell {
+    glm::ivec3 offset;
+    uint32_t resolution;
+    uint32_t coarsest;
+    uint32_t finest;
+};
+
+//The resolution of every offset in the grid, worked out once for the config instead of every frame. The cells go
+//from the camera chunk outwards in shells, nearest chunks get queued first.
+class LodShellTable {
+public:
+    LodShellTable(uint32_t gridSize, uint32_t gridHeight, uint32_t maxChunkResolution, const ScreenSpaceError &error,
+                  float lodHysteresis);
+
+    const std::vector<LodShellCell> &shells() const { return cells; }
+
+    //nullptr when the offset is outside the grid.
+    const LodShellCell *find(glm::ivec3 offset) const;
+
+    //Offset of a grid cell from the camera, given the grid coordinates of both. The grid wraps around in x and y.
+    glm::ivec3 offsetOf(glm::ivec3 gridCoord, glm::ivec3 cameraGridCoord) const;
+
+private:
+    int radius;
+    int gridSize;
+    int gridHeight;
+    std::vector<LodShellCell> cells;
+    //Index in cells of every offset, x fastest
+    std::vector<uint32_t> cellIndex;
+
+    size_t denseIndex(glm::ivec3 offset) const;
+};
+
+//Identifies a chunk file, the chunk coordinates together with the resolution it got generated at.
+struct ChunkKey {
+    glm::ivec3 chunkCoord;
+    uint32_t resolution;
+
+    bool operator==(const ChunkKey &other) const {
+        return chunkCoord == other.chunkCoord && resolution == other.resolution;
+    }
+};
+
+struct ChunkKeyHash {
+    size_t operator()(const ChunkKey &key) const {
+        uint64_t hash = static_cast<uint32_t>(key.chunkCoord.x) * 73856093ull;
+        hash ^= static_cast<uint32_t>(key.chunkCoord.y) * 19349663ull;
+        hash ^= static_cast<uint32_t>(key.chunkCoord.z) * 83492791ull;
+        hash ^= static_cast<uint64_t>(key.resolution) << 40;
+        return std::hash<uint64_t>{}(hash);
+    }
+};
+
+//The decoded contents of a chunk file.
+struct ChunkData {
+    uint32_t nodeCount = 0;
+    std::vector<uint32_t> gpuData;
+    std::vector<uint32_t> farValues;
+    //See computeNodeColors, stored after the far values
+    std::vector<uint32_t> nodeColors;
+    uint32_t treeLevels = 0;
+
+    size_t bytes() const {
+        return CHUNK_HEADER_SIZE + CHUNK_COLORS_HEADER_SIZE +
+               (gpuData.size() + farValues.size() + nodeColors.size()) * sizeof(uint32_t);
+    }
+
+    //Colors of the nodes with children, uploaded after the nodes so the chunk can later be drawn at a lower resolution
+    //without uploading anything but its chunk table entry. Leaves the colors empty for trees that are not breadth first.
+    void computeNodeColors() { treeLevels = breadthFirstNodeColors(gpuData, farValues, nodeColors); }
+};
+
+//An opened chunk file of which only the header has been read, so the caller can allocate memory for the payload
+//and read it straight into its destination (e.g. the mapped staging buffer) instead of through a std::vector.
+struct ChunkFile {
+    uint32_t nodeCount = 0;
+    uint32_t gpuDataSize = 0;
+    uint32_t farValuesSize = 0;
+    //0 for files without node colors
+    uint32_t nodeColorsSize = 0;
+    uint32_t treeLevels = 0;
+#ifdef _WIN32
+    std::ifstream stream;
+#else
+    int fd = -1;
+#endif
+
+    ChunkFile() = default;
+
+    ChunkFile(const ChunkFile &) = delete;
+
+    ChunkFile &operator=(const ChunkFile &) = delete;
+
+    ~ChunkFile();
+
+    void close();
+};
+
+std::filesystem::path chunkFilePath(const std::string &scenePath, uint32_t max_resolution, uint32_t svo_resolution,
+                                    glm::ivec3 gridCoords);
+
 bool saveChunk(const std::string &scenePath, uint32_t max_resolution, uint32_t svo_resolution, glm::ivec3 gridCoords,
-               uint32_t &nodeCount,
-               std::vector<uint32_t> &gpuData, std::vector<uint32_t> &farValues);
+               uint32_t nodeCount,
+               const std::vector<uint32_t> &gpuData, const std::vector<uint32_t> &farValues,
+               const std::vector<uint32_t> &nodeColors, uint32_t treeLevels);
 
 bool loadChunk(const std::string &scenePath, uint32_t max_resolution, uint32_t svo_resolution, glm::ivec3 gridCoords,
                uint32_t &nodeCount,
-               std::vector<uint32_t> &gpuData, std::vector<uint32_t> &farValues);
+               std::vector<uint32_t> &gpuData, std::vector<uint32_t> &farValues,
+               std::vector<uint32_t> &nodeColors, uint32_t &treeLevels);
+
+//Open the chunk file and read its header, returns false if the chunk has not been generated yet.
+bool openChunk(const std::string &scenePath, uint32_t max_resolution, uint32_t svo_resolution, glm::ivec3 gridCoords,
+               ChunkFile &file);
+
+//Read the payload of an opened chunk file directly into the given destinations, gpuDataDst needs room for gpuDataSize,
+//farValuesDst for farValuesSize and nodeColorsDst for nodeColorsSize uint32_t values.
+bool readChunkPayload(ChunkFile &file, void *gpuDataDst, void *farValuesDst, void *nodeColorsDst);
+
+//Where the node colors of an opened chunk file start.
+inline uint64_t chunkNodeColorsOffset(const ChunkFile &file) {
+    return CHUNK_HEADER_SIZE + (static_cast<uint64_t>(file.gpuDataSize) + file.farValuesSize) * sizeof(uint32_t) +
+           CHUNK_COLORS_HEADER_SIZE;
+}
 
 
 #endif //CHUNK_MANAGEMENT_H
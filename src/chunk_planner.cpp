@@ -0,0 +1,245 @@
+#include "chunk_planner.h"
+
+#include <algorithm>
+#include <map>
+
+#include "spdlog/spdlog.h"
+
+void addChunksAroundCamera(glm::ivec3 cameraChunk, const Config &config, ChunkKeySet &chunks, float lodHysteresis,
+                           uint32_t offscreenLodLevels) {
+    //Same bounds as the LodShellTable checkChunks walks
+    int rd = int((config.grid_size - 1) / 2);
+    int maxDistance = std::max(rd, int(config.grid_height));
+    ScreenSpaceError error(config);
+    for (int dz = -maxDistance; dz <= std::min(maxDistance, int(config.grid_height)); dz++) {
+        int z = cameraChunk.z + dz;
+        if (z < 0 || z >= int(config.grid_height)) {
+            continue;
+        }
+        for (int dy = -rd; dy <= rd; dy++) {
+            for (int dx = -rd; dx <= rd; dx++) {
+                auto [coarsest, finest] = chunkResolutionBand(glm::ivec3(dx, dy, dz), config.chunk_resolution,
+                                                              error, lodHysteresis);
+                //The camera path does not say where the camera looks, so any chunk can be outside the view.
+                coarsest = std::max(coarsest >> offscreenLodLevels, MIN_CHUNK_RESOLUTION);
+                for (uint32_t resolution = coarsest; resolution <= finest; resolution <<= 1) {
+                    chunks.insert({glm::ivec3(cameraChunk.x + dx, cameraChunk.y + dy, z), resolution});
+                }
+            }
+        }
+    }
+}
+
+void addOverviewChunks(glm::ivec3 cameraChunk, const Config &config, ChunkKeySet &chunks) {
+    if (config.overviewSize == 0) {
+        return;
+    }
+    int rd = int((config.overviewSize - 1) / 2);
+    for (int z = 0; z < int(config.grid_height); z++) {
+        for (int dy = -rd; dy <= rd; dy++) {
+            for (int dx = -rd; dx <= rd; dx++) {
+                chunks.insert({glm::ivec3(cameraChunk.x + dx, cameraChunk.y + dy, z), config.overviewResolution});
+            }
+        }
+    }
+}
+
+ChunkManifest::ChunkManifest(std::string scenePath, uint32_t maxResolution, std::string fileName)
+    : scenePath(std::move(scenePath)), maxResolution(maxResolution), fileName(std::move(fileName)) {
+}
+
+std::string ChunkManifest::shardFileName(uint32_t shardIndex, uint32_t shardCount) {
+    return std::format("manifest.shard-{}-of-{}.txt", shardIndex, shardCount);
+}
+
+std::filesystem::path ChunkManifest::path() const {
+    return std::filesystem::path(scenePath) / std::format("max_scene_resolution_{}", maxResolution) / fileName;
+}
+
+bool ChunkManifest::load() {
+    if (!mergeFile(path())) {
+        scanChunkDirectories();
+        spdlog::info("No chunk manifest found, found {} chunks on disk", chunks.size());
+        return true;
+    }
+    if (chunkDirectoriesNewer()) {
+        scanChunkDirectories();
+        spdlog::info("Chunk directories changed since the manifest was written, found {} chunks", chunks.size());
+        return true;
+    }
+    spdlog::info("Chunk manifest lists {} chunks", chunks.size());
+    return false;
+}
+
+bool ChunkManifest::mergeFile(const std::filesystem::path &file) {
+    std::ifstream input(file);
+    if (!input) return false;
+    std::lock_guard<std::mutex> lock(mut);
+    ChunkKey key{};
+    while (input >> key.chunkCoord.x >> key.chunkCoord.y >> key.chunkCoord.z >> key.resolution) {
+        chunks.insert(key);
+    }
+    return input.eof();
+}
+
+void ChunkManifest::merge(const ChunkManifest &other) {
+    std::scoped_lock lock(mut, other.mut);
+    chunks.insert(other.chunks.begin(), other.chunks.end());
+}
+
+std::vector<std::filesystem::path> ChunkManifest::shardFiles() const {
+    namespace fs = std::filesystem;
+    std::vector<fs::path> files;
+    std::error_code ec;
+    for (const auto &entry: fs::directory_iterator(path().parent_path(), ec)) {
+        std::string name = entry.path().filename().string();
+        if (name.starts_with("manifest.shard-") && name.ends_with(".txt")) {
+            files.push_back(entry.path());
+        }
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+void ChunkManifest::scanChunkDirectories() {
+    namespace fs = std::filesystem;
+    fs::path root = path().parent_path();
+    std::error_code ec;
+    if (!fs::is_directory(root, ec)) return;
+    for (const auto &resolutionDir: fs::directory_iterator(root, ec)) {
+        uint32_t resolution;
+        if (!resolutionDir.is_directory() ||
+            sscanf(resolutionDir.path().filename().string().c_str(), "chunk_resolution_%u", &resolution) != 1) {
+            continue;
+        }
+        for (const auto &chunkFile: fs::directory_iterator(resolutionDir.path(), ec)) {
+            if (chunkFile.path().extension() != ".svo") continue;
+            ChunkKey key{glm::ivec3(0), resolution};
+            if (sscanf(chunkFile.path().filename().string().c_str(), "x%d,y%d,z%d.svo", &key.chunkCoord.x,
+                       &key.chunkCoord.y, &key.chunkCoord.z) == 3) {
+                chunks.insert(key);
+            }
+        }
+    }
+}
+
+bool ChunkManifest::chunkDirectoriesNewer() const {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    auto manifestTime = fs::last_write_time(path(), ec);
+    if (ec) return true;
+    //Chunk files are renamed into place, which updates the modification time of their directory
+    for (const auto &resolutionDir: fs::directory_iterator(path().parent_path(), ec)) {
+        if (!resolutionDir.is_directory() ||
+            !resolutionDir.path().filename().string().starts_with("chunk_resolution_")) {
+            continue;
+        }
+        std::error_code timeError;
+        auto directoryTime = fs::last_write_time(resolutionDir.path(), timeError);
+        if (!timeError && directoryTime >= manifestTime) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool ChunkManifest::save() const {
+    namespace fs = std::filesystem;
+    std::lock_guard<std::mutex> lock(mut);
+    try {
+        fs::path filePath = path();
+        fs::create_directories(filePath.parent_path());
+        fs::path tempPath = filePath;
+        tempPath += ".tmp";
+        std::ofstream file(tempPath);
+        if (!file) return false;
+        for (const auto &key: chunks) {
+            file << key.chunkCoord.x << ' ' << key.chunkCoord.y << ' ' << key.chunkCoord.z << ' ' << key.resolution
+                    << '\n';
+        }
+        file.close();
+        if (!file) return false;
+        fs::rename(tempPath, filePath);
+        return true;
+    } catch (...) {
+        return false;
+    }
+}
+
+bool ChunkManifest::contains(const ChunkKey &key) const {
+    std::lock_guard<std::mutex> lock(mut);
+    return chunks.contains(key);
+}
+
+void ChunkManifest::add(const ChunkKey &key) {
+    std::lock_guard<std::mutex> lock(mut);
+    chunks.insert(key);
+}
+
+size_t ChunkManifest::size() const {
+    std::lock_guard<std::mutex> lock(mut);
+    return chunks.size();
+}
+
+uint64_t ChunkPlan::estimatedCost() const {
+    uint64_t cost = 0;
+    for (const auto &key: missing) {
+        cost += static_cast<uint64_t>(key.resolution) * key.resolution;
+    }
+    return cost;
+}
+
+uint64_t stableChunkHash(const ChunkKey &key) {
+    //splitmix64 over the packed key
+    uint64_t hash = static_cast<uint64_t>(static_cast<uint32_t>(key.chunkCoord.x)) << 32 |
+                    static_cast<uint32_t>(key.chunkCoord.y);
+    hash ^= (static_cast<uint64_t>(static_cast<uint32_t>(key.chunkCoord.z)) << 16) + key.resolution;
+    hash += 0x9e3779b97f4a7c15ull;
+    hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ull;
+    hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebull;
+    return hash ^ (hash >> 31);
+}
+
+void ChunkPlan::keepShard(uint32_t shardIndex, uint32_t shardCount) {
+    std::erase_if(missing, [&](const ChunkKey &key) { return stableChunkHash(key) % shardCount != shardIndex; });
+}
+
+void ChunkPlan::print() const {
+    std::map<uint32_t, size_t, std::greater<> > perResolution;
+    for (const auto &key: missing) {
+        perResolution[key.resolution]++;
+    }
+    std::string breakdown;
+    for (const auto &[resolution, count]: perResolution) {
+        breakdown += std::format(" {}^3: {}", resolution, count);
+    }
+    spdlog::info("Chunk plan: {} camera chunks need {} chunks, {} already generated, {} to generate",
+                 cameraChunks, neededChunks, neededChunks - missing.size(), missing.size());
+    spdlog::info("Chunks to generate per resolution:{}", breakdown.empty() ? " none" : breakdown);
+    spdlog::info("Estimated cost: {:.1f}M voxel columns", static_cast<double>(estimatedCost()) / 1e6);
+}
+
+ChunkPlan planChunks(const std::vector<glm::ivec3> &cameraChunks, const Config &config, const ChunkManifest &manifest) {
+    ChunkKeySet needed;
+    for (const auto &cameraChunk: cameraChunks) {
+        addChunksAroundCamera(cameraChunk, config, needed, config.lodHysteresis, config.offscreenLodLevels);
+        addOverviewChunks(cameraChunk, config, needed);
+    }
+
+    ChunkPlan plan;
+    plan.cameraChunks = cameraChunks.size();
+    plan.neededChunks = needed.size();
+    for (const auto &key: needed) {
+        if (!manifest.contains(key)) {
+            plan.missing.push_back(key);
+        }
+    }
+    //Biggest chunks first so the workers do not end on one slow chunk, and a fixed order so runs are reproducible.
+    std::sort(plan.missing.begin(), plan.missing.end(), [](const ChunkKey &a, const ChunkKey &b) {
+        if (a.resolution != b.resolution) return a.resolution > b.resolution;
+        if (a.chunkCoord.z != b.chunkCoord.z) return a.chunkCoord.z < b.chunkCoord.z;
+        if (a.chunkCoord.y != b.chunkCoord.y) return a.chunkCoord.y < b.chunkCoord.y;
+        return a.chunkCoord.x < b.chunkCoord.x;
+    });
+    return plan;
+}
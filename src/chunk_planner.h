@@ -0,0 +1,91 @@
+#pragma once
+
+#ifndef CHUNK_PLANNER_H
+#define CHUNK_PLANNER_H
+#include <mutex>
+#include <unordered_set>
+#include <vector>
+
+#include "chunk_management.h"
+#include "config.h"
+
+using ChunkKeySet = std::unordered_set<ChunkKey, ChunkKeyHash>;
+
+//Add every chunk checkChunks requests while the camera is in cameraChunk. With a lodHysteresis every resolution the
+//grid could keep within the hysteresis band gets added too, and with offscreenLodLevels the coarser resolutions chunks
+//outside the view get loaded at.
+void addChunksAroundCamera(glm::ivec3 cameraChunk, const Config &config, ChunkKeySet &chunks,
+                           float lodHysteresis = 0.0f, uint32_t offscreenLodLevels = 0);
+
+//Add the chunks of the overview while the camera is in cameraChunk.
+void addOverviewChunks(glm::ivec3 cameraChunk, const Config &config, ChunkKeySet &chunks);
+
+//The chunks that are on disk for a scene. Kept in a file next to the chunk directories, so chunkgen knows what exists
+//without opening every chunk file. One "x y z resolution" line per chunk.
+class ChunkManifest {
+public:
+    ChunkManifest(std::string scenePath, uint32_t maxResolution, std::string fileName = "manifest.txt");
+
+    //File the given chunkgen shard records its chunks in.
+    static std::string shardFileName(uint32_t shardIndex, uint32_t shardCount);
+
+    std::filesystem::path path() const;
+
+    //Read the manifest file, or rebuild it from the chunk directories when there is none or the directories changed since
+    //it was written (the streamer writes chunks without a manifest). Returns true when it got rebuilt, so the caller can
+    //save it.
+    bool load();
+
+    //Add the chunks listed in another manifest file, returns false if it could not be read.
+    bool mergeFile(const std::filesystem::path &file);
+
+    void merge(const ChunkManifest &other);
+
+    //Shard manifests next to this manifest that still have to be merged.
+    std::vector<std::filesystem::path> shardFiles() const;
+
+    bool save() const;
+
+    bool contains(const ChunkKey &key) const;
+
+    //Safe to call from multiple chunkgen workers.
+    void add(const ChunkKey &key);
+
+    size_t size() const;
+
+private:
+    std::string scenePath;
+    uint32_t maxResolution;
+    std::string fileName;
+    ChunkKeySet chunks;
+    mutable std::mutex mut;
+
+    void scanChunkDirectories();
+
+    //Whether a chunk got added to one of the chunk directories after the manifest file was written.
+    bool chunkDirectoriesNewer() const;
+};
+
+struct ChunkPlan {
+    size_t cameraChunks = 0;
+    //Every chunk the camera path needs
+    size_t neededChunks = 0;
+    //The needed chunks missing from the manifest, highest resolution first
+    std::vector<ChunkKey> missing;
+
+    //Generation time grows with the amount of voxel columns in a chunk, so resolution^2 summed over the chunks.
+    uint64_t estimatedCost() const;
+
+    //Drop the chunks that belong to other shards. The split only depends on the chunk itself, so every process
+    //planning the same path gets the same partition.
+    void keepShard(uint32_t shardIndex, uint32_t shardCount);
+
+    void print() const;
+};
+
+//Hash that is the same on every platform and build, unlike std::hash.
+uint64_t stableChunkHash(const ChunkKey &key);
+
+ChunkPlan planChunks(const std::vector<glm::ivec3> &cameraChunks, const Config &config, const ChunkManifest &manifest);
+
+#endif //CHUNK_PLANNER_H
@@ -0,0 +1,93 @@
+#include "chunk_write_queue.h"
+
+#include "spdlog/spdlog.h"
+
+ChunkWriteQueue::ChunkWriteQueue(std::string scenePath, uint32_t maxResolution, size_t maxBytes)
+    : scenePath(std::move(scenePath)), maxResolution(maxResolution), maxBytes(maxBytes) {
+    writerThread = std::thread([this]() { this->writerLoop(); });
+}
+
+ChunkWriteQueue::~ChunkWriteQueue() {
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        stopFlag = true;
+    }
+    cv.notify_all();
+    writerThread.join();
+}
+
+bool ChunkWriteQueue::enqueue(uint32_t svoResolution, glm::ivec3 chunkCoord, std::shared_ptr<const ChunkData> data) {
+    std::string key = chunkFilePath(scenePath, maxResolution, svoResolution, chunkCoord).string();
+    PendingWrite write{svoResolution, chunkCoord, std::move(data)};
+    size_t bytes = write.bytes(); {
+        std::lock_guard<std::mutex> lock(mut);
+        auto it = pending.find(key);
+        size_t replacedBytes = it != pending.end() ? it->second.bytes() : 0;
+        if (pendingBytes - replacedBytes + bytes > maxBytes) {
+            droppedWrites++;
+            return false;
+        }
+        if (it != pending.end()) {
+            //Still waiting to be written, replace the data but keep its place in the queue.
+            coalescedWrites++;
+            it->second = std::move(write);
+        } else {
+            order.push_back(key);
+            pending.emplace(std::move(key), std::move(write));
+        }
+        pendingBytes = pendingBytes - replacedBytes + bytes;
+    }
+    queuedBytes += bytes;
+    cv.notify_one();
+    return true;
+}
+
+void ChunkWriteQueue::flush() {
+    std::unique_lock<std::mutex> lock(mut);
+    flushedCv.wait(lock, [this] { return order.empty() && !writing; });
+}
+
+void ChunkWriteQueue::printStats() {
+    size_t waiting; {
+        std::lock_guard<std::mutex> lock(mut);
+        waiting = pendingBytes;
+    }
+    spdlog::info("Chunk writes: queued {:.2f} MB, written {:.2f} MB, waiting {:.2f} MB, coalesced {}, dropped {}, failed {}",
+                 static_cast<double>(queuedBytes.load()) / (1024.0 * 1024.0),
+                 static_cast<double>(writtenBytes.load()) / (1024.0 * 1024.0),
+                 static_cast<double>(waiting) / (1024.0 * 1024.0),
+                 coalescedWrites.load(), droppedWrites.load(), failedWrites.load());
+}
+
+void ChunkWriteQueue::writerLoop() {
+    while (true) {
+        PendingWrite write; {
+            std::unique_lock<std::mutex> lock(mut);
+            writing = false;
+            if (order.empty()) {
+                flushedCv.notify_all();
+            }
+            cv.wait(lock, [this] { return stopFlag || !order.empty(); });
+
+            //Everything queued gets written before we stop, so no generated chunk is lost on shutdown.
+            if (stopFlag && order.empty())
+                return;
+
+            auto it = pending.find(order.front());
+            order.pop_front();
+            write = std::move(it->second);
+            pending.erase(it);
+            pendingBytes -= write.bytes();
+            writing = true;
+        }
+
+        if (saveChunk(scenePath, maxResolution, write.svoResolution, write.chunkCoord, write.data->nodeCount,
+                      write.data->gpuData, write.data->farValues, write.data->nodeColors, write.data->treeLevels)) {
+            writtenBytes += write.bytes();
+        } else {
+            failedWrites++;
+            spdlog::error("Something went wrong storing Chunk data for {}, {}, {}", write.chunkCoord.x,
+                          write.chunkCoord.y, write.chunkCoord.z);
+        }
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#ifndef CHUNK_WRITE_QUEUE_H
+#define CHUNK_WRITE_QUEUE_H
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "chunk_management.h"
+
+//Persists freshly generated chunks on its own thread, so the streaming thread can upload them straight away.
+//Writes to the same chunk file that are still queued get coalesced into one, and when more than maxBytes are
+//waiting new writes are dropped, the chunk will simply be generated again the next time it is needed.
+class ChunkWriteQueue {
+public:
+    ChunkWriteQueue(std::string scenePath, uint32_t maxResolution, size_t maxBytes);
+
+    //Flushes everything that is still queued before returning.
+    ~ChunkWriteQueue();
+
+    //Returns false if the write got dropped because the queue is full.
+    bool enqueue(uint32_t svoResolution, glm::ivec3 chunkCoord, std::shared_ptr<const ChunkData> data);
+
+    //Block until every queued write is on disk.
+    void flush();
+
+    void printStats();
+
+private:
+    struct PendingWrite {
+        uint32_t svoResolution;
+        glm::ivec3 chunkCoord;
+        std::shared_ptr<const ChunkData> data;
+
+        size_t bytes() const { return data->bytes(); }
+    };
+
+    std::string scenePath;
+    uint32_t maxResolution;
+    size_t maxBytes;
+
+    std::thread writerThread;
+    std::mutex mut;
+    std::condition_variable cv;
+    std::condition_variable flushedCv;
+    bool stopFlag = false;
+    bool writing = false;
+    //Queue order of the files, the data is kept per file so a rewrite of a queued chunk replaces it.
+    std::deque<std::string> order;
+    std::unordered_map<std::string, PendingWrite> pending;
+    size_t pendingBytes = 0;
+
+    std::atomic<uint64_t> queuedBytes = 0;
+    std::atomic<uint64_t> writtenBytes = 0;
+    std::atomic<uint64_t> coalescedWrites = 0;
+    std::atomic<uint64_t> droppedWrites = 0;
+    std::atomic<uint64_t> failedWrites = 0;
+
+    void writerLoop();
+};
+
+#endif //CHUNK_WRITE_QUEUE_H
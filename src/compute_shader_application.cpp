@@ -141,6 +141,11 @@ void ComputeShaderApplication::cleanup() {
 
     vkDestroyDescriptorSetLayout(device, computeDescriptorSetLayout, nullptr);
 
+    octreeGPUManager->destroyChunkBuffers([this](VkBuffer buffer, VkDeviceMemory memory) {
+        vkDestroyBuffer(device, buffer, nullptr);
+        vkFreeMemory(device, memory, nullptr);
+    });
+
     for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
         for (size_t j = 0; j < shaderStorageBuffers[i].size(); j++) {
             vkDestroyBuffer(device, shaderStorageBuffers[i][j], nullptr);
@@ -151,6 +156,10 @@ void ComputeShaderApplication::cleanup() {
 
         vkFreeMemory(device, farValuesSBuffersMemory[i], nullptr);
         vkFreeMemory(device, gridBuffersMemory[i], nullptr);
+
+        vkUnmapMemory(device, feedbackBuffersMemory[i]);
+        vkDestroyBuffer(device, feedbackBuffers[i], nullptr);
+        vkFreeMemory(device, feedbackBuffersMemory[i], nullptr);
     }
 
     for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
@@ -179,6 +188,7 @@ void ComputeShaderApplication::cleanup() {
 }
 
 void ComputeShaderApplication::updateUniformCameraBuffer() {
+    camera.gpu_camera.frame++;
     memcpy(uniformCameraBuffersMapped[currentFrame], &camera.gpu_camera, sizeof(Camera));
 }
 
@@ -210,7 +220,8 @@ void ComputeShaderApplication::createInstance() {
     appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
     appInfo.pEngineName = "No Engine";
     appInfo.engineVersion = VK_MAKE_VERSION(1, 1, 0);
-    appInfo.apiVersion = VK_API_VERSION_1_0;
+    //1.2 for timeline semaphores
+    appInfo.apiVersion = VK_API_VERSION_1_2;
 
     VkInstanceCreateInfo createInfo{};
     createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
@@ -319,6 +330,12 @@ void ComputeShaderApplication::createLogicalDevice() {
     indexingFeatures.descriptorBindingVariableDescriptorCount = VK_TRUE;
     indexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
 
+    //Chunk uploads track their completion with a timeline semaphore
+    VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeatures{};
+    timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+    timelineFeatures.timelineSemaphore = VK_TRUE;
+    indexingFeatures.pNext = &timelineFeatures;
+
     VkPhysicalDeviceFeatures2 deviceFeatures2{};
     deviceFeatures2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
     deviceFeatures2.pNext = &indexingFeatures;
@@ -367,7 +384,19 @@ void ComputeShaderApplication::getMaxBufferSize() {
     vkGetPhysicalDeviceProperties2(physicalDevice, &properties2);
     VkDeviceSize maxAllocSize = maintenance3Properties.maxMemoryAllocationSize;
 
-    maxBufferSize = std::min(maxStorageBufferRange, maxAllocSize) / sizeof(uint32_t);
+    //A power of two so the shader can find the buffer of a node index with a shift
+    maxBufferSize = static_cast<uint32_t>(std::bit_floor(std::min(maxStorageBufferRange, maxAllocSize) /
+                                                         sizeof(uint32_t)));
+
+    if (config.bindlessChunks) {
+        //A descriptor and an allocation per chunk, leave room for the other storage buffers and allocations
+        const VkPhysicalDeviceLimits &limits = deviceProperties.limits;
+        uint32_t descriptors = std::min(limits.maxPerStageDescriptorStorageBuffers,
+                                        limits.maxDescriptorSetStorageBuffers) - 4;
+        uint32_t allocations = limits.maxMemoryAllocationCount - 64;
+        voxelDescriptorCount = std::min({descriptors, allocations, MAX_BINDLESS_CHUNK_BUFFERS});
+        spdlog::info("Bindless chunk buffers: up to {}", voxelDescriptorCount);
+    }
 }
 
 void ComputeShaderApplication::createSwapChain() {
@@ -516,7 +545,7 @@ void ComputeShaderApplication::createGraphicsDescriptorSetLayout() {
 }
 
 void ComputeShaderApplication::createComputeDescriptorSetLayout() {
-    std::array<VkDescriptorSetLayoutBinding, 7> layoutBindings{};
+    std::array<VkDescriptorSetLayoutBinding, 8> layoutBindings{};
     layoutBindings[0].binding = 0;
     layoutBindings[0].descriptorCount = 1;
     layoutBindings[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
@@ -554,15 +583,22 @@ void ComputeShaderApplication::createComputeDescriptorSetLayout() {
     layoutBindings[5].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
 
     layoutBindings[6].binding = 6;
-    layoutBindings[6].descriptorCount = MAX_VOXEL_BUFFERS;
+    layoutBindings[6].descriptorCount = 1;
     layoutBindings[6].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
     layoutBindings[6].pImmutableSamplers = nullptr;
     layoutBindings[6].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
 
+    //The variable count binding has to be the last one
+    layoutBindings[7].binding = 7;
+    layoutBindings[7].descriptorCount = voxelDescriptorCount;
+    layoutBindings[7].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    layoutBindings[7].pImmutableSamplers = nullptr;
+    layoutBindings[7].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
 
     // Add per-binding flags
-    std::array<VkDescriptorBindingFlags, 7> bindingFlags{};
-    bindingFlags[6] = VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT |
+    std::array<VkDescriptorBindingFlags, 8> bindingFlags{};
+    bindingFlags[7] = VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT |
                       VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT;
 
     VkDescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo{};
@@ -845,7 +881,9 @@ void ComputeShaderApplication::createShaderStorageBuffer(std::vector<uint32_t> &
         for (size_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
             createBuffer(
                 chunkBufferSize,
-                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                //Transfer source too so the compaction can move chunks within the buffer
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                VK_BUFFER_USAGE_TRANSFER_DST_BIT,
                 VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffers[frame][chunk],
                 buffersMemory[frame][chunk]);
             copyBuffer(stagingBuffer, buffers[frame][chunk], chunkBufferSize);
@@ -881,6 +919,24 @@ void ComputeShaderApplication::createDebugShaderStorageBuffer() {
     }
 }
 
+VkDeviceSize ComputeShaderApplication::feedbackBufferSize() const {
+    return sizeof(uint32_t) * config.grid_height * config.grid_size * config.grid_size;
+}
+
+void ComputeShaderApplication::createFeedbackBuffers() {
+    VkDeviceSize bufferSize = feedbackBufferSize();
+    feedbackBuffers.resize(MAX_FRAMES_IN_FLIGHT);
+    feedbackBuffersMemory.resize(MAX_FRAMES_IN_FLIGHT);
+    feedbackBuffersMapped.resize(MAX_FRAMES_IN_FLIGHT);
+    for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
+        createBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                     VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, feedbackBuffers[i],
+                     feedbackBuffersMemory[i]);
+        vkMapMemory(device, feedbackBuffersMemory[i], 0, bufferSize, 0, &feedbackBuffersMapped[i]);
+        memset(feedbackBuffersMapped[i], 0, bufferSize);
+    }
+}
+
 template<typename T>
 void ComputeShaderApplication::createSingleShaderStorageBuffer(std::vector<T> &dataVec, std::vector<VkBuffer> &buffers,
                                                                std::vector<VkDeviceMemory> &buffersMemory) {
@@ -906,7 +962,8 @@ void ComputeShaderApplication::createSingleShaderStorageBuffer(std::vector<T> &d
     for (size_t i = 0; i < MAX_FRAMES_IN_FLIGHT; i++) {
         createBuffer(
             bufferSize,
-            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+            VK_BUFFER_USAGE_TRANSFER_DST_BIT,
             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffers[i],
             buffersMemory[i]);
         copyBuffer(stagingBuffer, buffers[i], bufferSize);
@@ -921,12 +978,86 @@ void ComputeShaderApplication::createShaderStorageBuffers() {
     createSingleShaderStorageBuffer(farValues, farValuesSBuffers, farValuesSBuffersMemory);
     createSingleShaderStorageBuffer(gridValues, gridBuffers, gridBuffersMemory);
     createDebugShaderStorageBuffer();
+    createFeedbackBuffers();
+}
+
+VkDeviceSize ComputeShaderApplication::octreeBudgetBytes() {
+    VkDeviceSize budget = config.octreePoolMaxBytes;
+    if (budget == 0) {
+        VkPhysicalDeviceMemoryProperties memoryProperties;
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+        for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+            if (memoryProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+                budget = std::max(budget, memoryProperties.memoryHeaps[i].size / 2);
+            }
+        }
+    }
+    return budget;
+}
+
+uint32_t ComputeShaderApplication::maxOctreeBuffers() {
+    VkDeviceSize bufferBytes = static_cast<VkDeviceSize>(maxBufferSize) * sizeof(uint32_t);
+    VkDeviceSize budget = octreeBudgetBytes();
+    //Node indices are 32 bit in the shader, every buffer has to start below that
+    uint64_t indexLimit = (uint64_t{1} << 32) >> std::countr_zero(maxBufferSize);
+    return static_cast<uint32_t>(std::min<uint64_t>({MAX_VOXEL_BUFFERS, indexLimit, budget / bufferBytes}));
+}
+
+void ComputeShaderApplication::writeOctreeDescriptor(size_t frame, uint32_t index, VkBuffer buffer) {
+    VkDescriptorBufferInfo info{};
+    info.buffer = buffer;
+    info.offset = 0;
+    info.range = VK_WHOLE_SIZE;
+
+    VkWriteDescriptorSet descriptorWrite{};
+    descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    descriptorWrite.dstSet = computeDescriptorSets[frame];
+    descriptorWrite.dstBinding = 7;
+    descriptorWrite.dstArrayElement = index;
+    descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    descriptorWrite.descriptorCount = 1;
+    descriptorWrite.pBufferInfo = &info;
+    vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+}
+
+void ComputeShaderApplication::growOctreePool() {
+    if (octreeGPUManager->isBindless()) {
+        octreeGPUManager->bindNewBuffers(
+            [this](uint32_t index, VkBuffer buffer) {
+                for (size_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+                    writeOctreeDescriptor(frame, index, buffer);
+                }
+            },
+            [this](VkBuffer buffer, VkDeviceMemory memory) {
+                vkDestroyBuffer(device, buffer, nullptr);
+                vkFreeMemory(device, memory, nullptr);
+            });
+        return;
+    }
+    if (!octreeGPUManager->growthRequested()) {
+        return;
+    }
+    VkDeviceSize bufferBytes = static_cast<VkDeviceSize>(maxBufferSize) * sizeof(uint32_t);
+    for (size_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; frame++) {
+        VkBuffer buffer;
+        VkDeviceMemory bufferMemory;
+        createBuffer(bufferBytes,
+                     VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT |
+                     VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                     VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, bufferMemory);
+        uint32_t arrayElement = static_cast<uint32_t>(shaderStorageBuffers[frame].size());
+        shaderStorageBuffers[frame].push_back(buffer);
+        shaderStorageBuffersMemory[frame].push_back(bufferMemory);
+        writeOctreeDescriptor(frame, arrayElement, buffer);
+    }
+    octreeGPUManager->addBuffer(shaderStorageBuffers[0].back());
 }
 
 void ComputeShaderApplication::createUniformBuffers() {
     //Get max buffer size in gridInfo before we copy it over
-    gridInfo.bufferSize = maxBufferSize;
-    spdlog::debug("Max BufferSize: {}", gridInfo.bufferSize);
+    //Chunk buffers are picked by the chunk table entry, all node indices stay below 1 << 31
+    gridInfo.bufferShift = config.bindlessChunks ? 31u : static_cast<uint32_t>(std::countr_zero(maxBufferSize));
+    spdlog::debug("Max BufferSize: {}", maxBufferSize);
 
     VkDeviceSize bufferSize = sizeof(GridInfo);
     VkDeviceSize cBufferSize = sizeof(Camera);
@@ -977,12 +1108,12 @@ void ComputeShaderApplication::createGraphicsDescriptorPool() {
 }
 
 void ComputeShaderApplication::createComputeDescriptorPool() {
-    std::array<VkDescriptorPoolSize, 7> poolSizes{};
+    std::array<VkDescriptorPoolSize, 8> poolSizes{};
     poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
     poolSizes[0].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
 
     poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-    poolSizes[1].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT) * MAX_VOXEL_BUFFERS;
+    poolSizes[1].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT) * voxelDescriptorCount;
 
     poolSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
     poolSizes[2].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
@@ -999,6 +1130,9 @@ void ComputeShaderApplication::createComputeDescriptorPool() {
     poolSizes[6].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
     poolSizes[6].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
 
+    poolSizes[7].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    poolSizes[7].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
+
     VkDescriptorPoolCreateInfo poolInfo{};
     poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
     poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
@@ -1122,8 +1256,8 @@ void ComputeShaderApplication::createGraphicsDescriptorSets() {
 }
 
 void ComputeShaderApplication::createComputeDescriptorSets() {
-    const uint32_t variableDescriptorCount = static_cast<uint32_t>(shaderStorageBuffers[0].size());
-    // e.g., 32 chunks
+    //Room for every octree buffer the pool can grow to, the ones that do not exist yet stay unbound
+    const uint32_t variableDescriptorCount = voxelDescriptorCount;
     std::vector<uint32_t> variableDescriptorCounts(MAX_FRAMES_IN_FLIGHT, variableDescriptorCount);
 
     std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, computeDescriptorSetLayout);
@@ -1151,7 +1285,7 @@ void ComputeShaderApplication::createComputeDescriptorSets() {
         uniformBufferInfo.offset = 0;
         uniformBufferInfo.range = sizeof(GridInfo);
 
-        std::array<VkWriteDescriptorSet, 7> descriptorWrites{};
+        std::array<VkWriteDescriptorSet, 8> descriptorWrites{};
         descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
         descriptorWrites[0].dstSet = computeDescriptorSets[i];
         descriptorWrites[0].dstBinding = 0;
@@ -1235,29 +1369,35 @@ void ComputeShaderApplication::createComputeDescriptorSets() {
         for (int j = 0; j < shaderStorageBuffers[i].size(); j++) {
             VkBuffer *buffer = &shaderStorageBuffers[i][j];
             // for (VkBuffer buffer: shaderStorageBuffers[i]) {
-            uint32_t range = sizeof(uint32_t) * octreeGPU.size();
-            if (shaderStorageBuffers[i].size() > 1) {
-                range = std::min(maxBufferSize,
-                                 static_cast<uint32_t>(octreeGPU.size() - (maxBufferSize * j)));
-            }
-
 
             VkDescriptorBufferInfo info{};
             info.buffer = *buffer;
             info.offset = 0;
-            // info.range = VK_WHOLE_SIZE;
-            info.range = (VkDeviceSize) range;
+            info.range = VK_WHOLE_SIZE;
             storageBufferInfos.push_back(info);
         }
 
+        VkDescriptorBufferInfo feedbackBufferInfo{};
+        feedbackBufferInfo.buffer = feedbackBuffers[i];
+        feedbackBufferInfo.offset = 0;
+        feedbackBufferInfo.range = feedbackBufferSize();
+
         descriptorWrites[6].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
         descriptorWrites[6].dstSet = computeDescriptorSets[i];
         descriptorWrites[6].dstBinding = 6;
         descriptorWrites[6].dstArrayElement = 0;
         descriptorWrites[6].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-        descriptorWrites[6].descriptorCount = static_cast<uint32_t>(storageBufferInfos.size());
+        descriptorWrites[6].descriptorCount = 1;
+        descriptorWrites[6].pBufferInfo = &feedbackBufferInfo;
+
+        descriptorWrites[7].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[7].dstSet = computeDescriptorSets[i];
+        descriptorWrites[7].dstBinding = 7;
+        descriptorWrites[7].dstArrayElement = 0;
+        descriptorWrites[7].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        descriptorWrites[7].descriptorCount = static_cast<uint32_t>(storageBufferInfos.size());
         // descriptorWrites[5].pBufferInfo = &storageBufferInfoCurrentFrame;
-        descriptorWrites[6].pBufferInfo = storageBufferInfos.data();
+        descriptorWrites[7].pBufferInfo = storageBufferInfos.data();
 
 
         vkUpdateDescriptorSets(device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0,
@@ -1468,6 +1608,21 @@ void ComputeShaderApplication::recordComputeCommandBuffer(VkCommandBuffer comman
     vkCmdDispatch(commandBuffer, std::ceil(config.width / config.x_groupsize),
                   std::ceil(config.height / config.y_groupsize), 1);
 
+    if (config.traversalFeedback) {
+        //The fence alone does not make the shader writes visible to the host reading the feedback
+        VkBufferMemoryBarrier feedbackBarrier{};
+        feedbackBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        feedbackBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        feedbackBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        feedbackBarrier.buffer = feedbackBuffers[current_frame];
+        feedbackBarrier.offset = 0;
+        feedbackBarrier.size = VK_WHOLE_SIZE;
+        feedbackBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        feedbackBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0,
+                             nullptr, 1, &feedbackBarrier, 0, nullptr);
+    }
+
     if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
         throw std::runtime_error("failed to record compute command buffer!");
     }
@@ -1556,6 +1711,13 @@ void ComputeShaderApplication::drawFrame() {
     // Compute submission
     vkWaitForFences(device, 1, &computeInFlightFences[currentFrame], VK_TRUE, UINT64_MAX);
     // vkWaitForFences(device, 1, &renderingFence, VK_TRUE, UINT64_MAX);
+    if (config.traversalFeedback) {
+        //The frame that wrote it is done, start the next one from nothing
+        dmThreat->applyTraversalFeedback(static_cast<const uint32_t *>(feedbackBuffersMapped[currentFrame]));
+        memset(feedbackBuffersMapped[currentFrame], 0, feedbackBufferSize());
+    }
+    //The descriptor set is not in use anymore, so a new octree buffer can be bound before this frame records
+    growOctreePool();
     updateUniformCameraBuffer();
 #if SHADERDEBUG
     // Safe to map now
@@ -1751,7 +1913,24 @@ bool ComputeShaderApplication::isDeviceSuitable(VkPhysicalDevice device) {
         swapChainAdequate = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
     }
 
-    return indices.isComplete() && extensionsSupported && swapChainAdequate;
+    //Chunk uploads need timeline semaphores, core since Vulkan 1.2
+    VkPhysicalDeviceProperties properties;
+    vkGetPhysicalDeviceProperties(device, &properties);
+    bool timelineSupported = false;
+    if (properties.apiVersion >= VK_API_VERSION_1_2) {
+        VkPhysicalDeviceTimelineSemaphoreFeatures timelineFeatures{};
+        timelineFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES;
+        VkPhysicalDeviceFeatures2 features2{};
+        features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features2.pNext = &timelineFeatures;
+        vkGetPhysicalDeviceFeatures2(device, &features2);
+        timelineSupported = timelineFeatures.timelineSemaphore == VK_TRUE;
+    }
+    if (!timelineSupported) {
+        spdlog::warn("Skipping {}, it does not support timeline semaphores", properties.deviceName);
+    }
+
+    return indices.isComplete() && extensionsSupported && swapChainAdequate && timelineSupported;
 }
 
 bool ComputeShaderApplication::checkDeviceExtensionSupport(VkPhysicalDevice device) {
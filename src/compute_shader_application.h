@@ -31,9 +31,11 @@
 #include <atomic>
 #include <optional>
 #include <set>
+#include <bit>
 
 #include "config.h"
 #include "data_manage_threat.h"
+#include "octree_pool.h"
 #include "structures.h"
 #include "scene_metadata.h"
 
@@ -42,6 +44,8 @@
 
 const int MAX_FRAMES_IN_FLIGHT = 1;
 const int MAX_VOXEL_BUFFERS = 32;
+//Upper limit of the VoxelSSBO array with a buffer per chunk, the device limits can lower it
+const uint32_t MAX_BINDLESS_CHUNK_BUFFERS = 1 << 16;
 
 const std::vector<const char *> validationLayers = {
     "VK_LAYER_KHRONOS_validation"
@@ -152,6 +156,10 @@ private:
     std::vector<VkDeviceMemory> farValuesSBuffersMemory;
     std::vector<VkDeviceMemory> gridBuffersMemory;
     std::vector<VkDeviceMemory> debugBuffersMemory;
+    //Traversal feedback, one value per grid slot, read on the CPU once the frame is done
+    std::vector<VkBuffer> feedbackBuffers;
+    std::vector<VkDeviceMemory> feedbackBuffersMemory;
+    std::vector<void *> feedbackBuffersMapped;
 
     StagingBufferProperties stagingBufferProperties;
 
@@ -190,6 +198,8 @@ private:
     std::vector<VkFence> computeInFlightFences;
     uint32_t currentFrame = 0;
     uint32_t maxBufferSize = 0;
+    //Size of the VoxelSSBO array, one per pool buffer, or one per chunk with bindless chunk buffers
+    uint32_t voxelDescriptorCount = MAX_VOXEL_BUFFERS;
 
     //TODO: Rename gridinfo to proper name...
     GridInfo gridInfo;
@@ -210,8 +220,8 @@ private:
     uint32_t totalSteps;
     uint32_t maxSteps;
 
-    BufferManager *stagingBufferManager;
-    BufferManager *octreeGPUManager;
+    StagingRing *stagingRing;
+    OctreePool *octreeGPUManager;
     BufferManager *farValuesGPUManager;
     DataManageThreat *dmThreat;
     std::optional<SceneMetadata> objSceneMetaData = std::nullopt;
@@ -287,12 +297,28 @@ private:
 
     void createDebugShaderStorageBuffer();
 
+    void createFeedbackBuffers();
+
+    VkDeviceSize feedbackBufferSize() const;
+
     template<typename T>
     void createSingleShaderStorageBuffer(std::vector<T> &dataVec, std::vector<VkBuffer> &buffers,
                                          std::vector<VkDeviceMemory> &buffersMemory);
 
     void createShaderStorageBuffers();
 
+    //Device memory the octree nodes may take
+    VkDeviceSize octreeBudgetBytes();
+
+    //Octree buffers the device budget allows, counting the ones created at the start.
+    uint32_t maxOctreeBuffers();
+
+    void writeOctreeDescriptor(size_t frame, uint32_t index, VkBuffer buffer);
+
+    //Create and bind another octree buffer if the pool ran out of room, or bind the new chunk buffers in bindless mode.
+    //Only when the GPU is done with the frame.
+    void growOctreePool();
+
     void createUniformBuffers();
 
     void createGraphicsDescriptorPool();
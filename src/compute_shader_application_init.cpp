@@ -17,13 +17,17 @@ void ComputeShaderApplication::initData() {
     // This function initializes all the vectors that get copied over onto the GPU,
     // as we are loading in everything after the initial setup through the staging buffer,
     // we actually dont do anything other than setting the size of those buffers here.
-    gridValues = std::vector<Chunk>(config.grid_height * config.grid_size * config.grid_size);
+    //The overview entries come after the grid in the same chunk table, nothing is in either yet.
+    size_t overviewEntries = static_cast<size_t>(config.grid_height) * config.overviewSize * config.overviewSize;
+    gridValues = std::vector<Chunk>(config.grid_height * config.grid_size * config.grid_size + overviewEntries,
+                                    Chunk(0, 0, UINT32_MAX, 0, NO_CHUNK_COORDS));
     cpuGridValues = std::vector<CpuChunk>(config.grid_height * config.grid_size * config.grid_size);
     farValues = std::vector<uint32_t>(config.GIGABYTE / sizeof(uint32_t));
-    octreeGPU = std::vector<uint32_t>(config.GIGABYTE * 3 / sizeof(uint32_t));
+    //With a buffer per chunk only the placeholder the empty chunk table entries point at is created up front
+    octreeGPU = std::vector<uint32_t>(config.bindlessChunks ? 16 : config.GIGABYTE * 3 / sizeof(uint32_t));
 
     //GPU Ubo object? I think...
-    gridInfo = GridInfo(config.chunk_resolution, config.grid_size, config.grid_height);
+    gridInfo = GridInfo(config.chunk_resolution, config.grid_size, config.grid_height, config.overviewSize);
     if (!config.useHeightmapData) {
         objSceneMetaData = SceneMetadata(config.scene_path, config);
         spdlog::debug("ObjFile to be loaded: {}", objSceneMetaData->objFile);
@@ -48,12 +52,31 @@ void ComputeShaderApplication::initThreads() {
     //Init the data and threads necessary for gpu chunk stuffs.
     farValuesGPUManager = new BufferManager(farValuesSBuffers[0], farValues.size(),
                                             "Far Values Buffer", sizeof(uint32_t));
-    octreeGPUManager = new BufferManager(shaderStorageBuffers[0][0], octreeGPU.size(),
-                                         "Octree Nodes Buffer", sizeof(uint32_t));
-    stagingBufferManager = new BufferManager(shaderStorageBuffers[0][0], config.staging_size,
-                                             "Staging Buffer", 1);
+    if (config.bindlessChunks) {
+        auto createChunkBuffer = [this](VkDeviceSize size, VkBuffer &buffer, VkDeviceMemory &memory) {
+            try {
+                createBuffer(size, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                             VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, buffer, memory);
+            } catch (const std::runtime_error &) {
+                //Out of device memory, the buffer can exist without memory
+                if (buffer != VK_NULL_HANDLE) vkDestroyBuffer(device, buffer, nullptr);
+                return false;
+            }
+            return true;
+        };
+        octreeGPUManager = new OctreePool(shaderStorageBuffers[0][0], maxBufferSize, voxelDescriptorCount,
+                                          octreeBudgetBytes(), config.bindlessSpareBytes, createChunkBuffer,
+                                          "Octree Chunk Buffers");
+    } else {
+        //Every buffer but the last is maxBufferSize elements, the pool spans them all and can grow into more.
+        size_t lastBufferElements = octreeGPU.size() - static_cast<size_t>(maxBufferSize) *
+                                    (shaderStorageBuffers[0].size() - 1);
+        octreeGPUManager = new OctreePool(shaderStorageBuffers[0], maxBufferSize, lastBufferElements,
+                                          maxOctreeBuffers(), "Octree Nodes Buffer");
+    }
+    stagingRing = new StagingRing(config.staging_size, "Staging Buffer");
 
 
-    dmThreat = new DataManageThreat(device, stagingBufferProperties, config, *octreeGPUManager, *stagingBufferManager,
+    dmThreat = new DataManageThreat(device, stagingBufferProperties, config, *octreeGPUManager, *stagingRing,
                                     gridBuffers[0], *farValuesGPUManager, objSceneMetaData, cpuGridValues, camera);
 }
@@ -6,10 +6,11 @@
 
 void ComputeShaderApplication::mainLoop() {
     double lastPrint = glfwGetTime();
+    CameraMotion cameraMotion;
     while (!glfwWindowShouldClose(window)) {
         static const auto startTime = glfwGetTime();
+        double totalElapsed = glfwGetTime() - startTime;
         if (config.cameraKeyFrames) {
-            double totalElapsed = glfwGetTime() - startTime;
             auto kf = interpolateCamera(config.cameraKeyFrames.value(), static_cast<float>(totalElapsed));
             if (objSceneMetaData) {
                 camera.setPosition(kf.position * objSceneMetaData->scale);
@@ -22,7 +23,22 @@ void ComputeShaderApplication::mainLoop() {
         if (config.allowUserInput) {
             processInput();
         }
-        checkChunks(cpuGridValues, camera, config.chunk_resolution, config.voxelscale, config.scaleDistance, *dmThreat);
+        if (config.prefetchSeconds > 0.0f) {
+            //A camera path tells exactly where the camera will be, otherwise extrapolate how it is moving.
+            glm::vec3 predicted;
+            if (config.cameraKeyFrames) {
+                auto kf = interpolateCamera(config.cameraKeyFrames.value(),
+                                            static_cast<float>(totalElapsed) + config.prefetchSeconds);
+                predicted = objSceneMetaData ? kf.position * objSceneMetaData->scale : kf.position;
+            } else {
+                glm::vec3 position = glm::vec3(camera.chunk_coords) * static_cast<float>(camera.maxChunkResolution) +
+                                     camera.gpu_camera.position;
+                cameraMotion.update(position, totalElapsed);
+                predicted = cameraMotion.predict(config.prefetchSeconds);
+            }
+            dmThreat->prefetch(glm::ivec3(glm::floor(predicted / static_cast<float>(camera.maxChunkResolution))));
+        }
+        checkChunks(cpuGridValues, camera, *dmThreat);
         glfwPollEvents();
         drawFrame();
         double currentTime = glfwGetTime();
@@ -34,7 +50,8 @@ void ComputeShaderApplication::mainLoop() {
             spdlog::info("FPS: {}, msPf: {}", (frameCounter / elapsed), 1000 / (frameCounter / elapsed));
             farValuesGPUManager->printBufferInfo();
             octreeGPUManager->printBufferInfo();
-            stagingBufferManager->printBufferInfo();
+            stagingRing->printBufferInfo();
+            dmThreat->printStats();
 #if SHADERDEBUG
             spdlog::info("Average Steps per ray: {}", (totalSteps / (float) (config.width * config.height)));
             spdlog::info("Max Steps per ray: {}", maxSteps);
@@ -78,8 +78,51 @@ Config::Config(int argc, char *argv[]) {
             ("t, test", "Which test scenario to run", cxxopts::value<uint32_t>())
             ("chunkgen", "Generate chunks needed for a certain camera position",
              cxxopts::value<bool>()->default_value("false"))
+            ("chunkgen-threads", "Worker threads to generate chunks with, 0 for all cores", cxxopts::value<uint32_t>())
+            ("plan-only", "Print the chunkgen plan without generating anything")
+            ("shard", "Only generate shard i of N of the chunkgen plan, given as i/N", cxxopts::value<std::string>())
+            ("merge-shards", "Merge the manifests written by chunkgen shards")
+            ("bench-allocator", "Benchmark the GPU pool allocators with this many resident chunks",
+             cxxopts::value<uint32_t>()->implicit_value("20000"))
             ("c, camera", "Camera position for the float location", cxxopts::value<std::string>())
             ("campath", "Make the camera follow a set path")
+            ("stream-threads", "Threads loading chunks while streaming", cxxopts::value<uint32_t>())
+            ("io-depth", "Amount of chunk reads to keep in flight", cxxopts::value<uint32_t>())
+            ("io-threads", "Threads used for chunk reads when io_uring is unavailable", cxxopts::value<uint32_t>())
+            ("write-behind", "MB of generated chunks allowed to wait for being written to disk",
+             cxxopts::value<uint32_t>())
+            ("chunk-cache", "MB of recently used chunks to keep in memory, 0 to disable", cxxopts::value<uint32_t>())
+            ("prefetch", "Seconds ahead of the camera to prefetch chunks into the cache, 0 to disable",
+             cxxopts::value<float>())
+            ("pixel-error", "Pixels a voxel may cover on screen before a finer chunk gets loaded",
+             cxxopts::value<float>())
+            ("resolution", "Render resolution as WIDTHxHEIGHT, also used for the LOD", cxxopts::value<std::string>())
+            ("lod-hysteresis", "LOD levels a chunk may be off before it gets reloaded", cxxopts::value<float>())
+            ("lod-residency", "Min seconds a chunk stays loaded before its LOD may change", cxxopts::value<float>())
+            ("offscreen-lod", "LOD levels coarser that chunks outside the view get loaded at, off unless given (e.g. 2)",
+             cxxopts::value<uint32_t>())
+            ("frustum-guard", "Degrees around the view that still count as inside it", cxxopts::value<float>())
+            ("traversal-feedback", "Load chunks at the resolution the rays entering them need, up to --offscreen-lod "
+             "levels coarser")
+            ("frame-target", "Frame time in ms the upload budget adapts to, 0 for a fixed budget",
+             cxxopts::value<double>())
+            ("upload-budget", "Max MB uploaded per frame", cxxopts::value<uint32_t>())
+            ("upload-chunks", "Max chunks uploaded per frame", cxxopts::value<uint32_t>())
+            ("compaction-budget", "MB of chunks moved per frame to defragment the GPU pools, 0 to disable",
+             cxxopts::value<uint32_t>())
+            ("compaction-threshold", "Fragmentation (0-1) of a GPU pool at which chunks start getting moved",
+             cxxopts::value<float>())
+            ("octree-pool", "Max MB of GPU memory for octree nodes, 0 for half of the GPU memory",
+             cxxopts::value<uint32_t>())
+            ("bindless-chunks", "Give every chunk its own octree buffer instead of sharing the pool buffers")
+            ("bindless-spare", "MB of freed chunk buffers kept for reuse with --bindless-chunks",
+             cxxopts::value<uint32_t>())
+            ("gpu-budget", "MB of chunk data kept on the GPU before far chunks get downgraded, 0 for no limit",
+             cxxopts::value<uint32_t>())
+            ("overview", "Chunks across of the low resolution overview, off unless given. Adds overview^2 * "
+             "gridheight chunk table entries, loads and chunkgen work, twice the grid size is a good start",
+             cxxopts::value<uint32_t>())
+            ("overview-res", "Resolution of the overview chunks (must be a power of 2)", cxxopts::value<uint32_t>())
             ("h, help", "Print how to use the program");
     // ();
     auto result = options.parse(argc, argv);
@@ -91,6 +134,22 @@ Config::Config(int argc, char *argv[]) {
 
 
     chunkgen = result["chunkgen"].as<bool>();
+    chunkgenPlanOnly = result.count("plan-only") > 0;
+    mergeShards = result.count("merge-shards") > 0;
+    if (result.count("bench-allocator")) {
+        allocatorBenchmarkChunks = result["bench-allocator"].as<uint32_t>();
+    }
+    if (result.count("shard")) {
+        auto shard = result["shard"].as<std::string>();
+        if (sscanf(shard.c_str(), "%u/%u", &shardIndex, &shardCount) != 2 || shardCount == 0 ||
+            shardIndex >= shardCount) {
+            spdlog::error("Invalid shard {}, expected i/N with i < N", shard);
+            exit(1);
+        }
+    }
+    if (result.count("chunkgen-threads")) {
+        chunkgenThreads = result["chunkgen-threads"].as<uint32_t>();
+    }
     if (result.count("test")) {
         printChunkDebug = false;
         allowUserInput = false;
@@ -172,6 +231,103 @@ Config::Config(int argc, char *argv[]) {
     }
 
 
+    if (result.count("io-depth")) {
+        ioQueueDepth = result["io-depth"].as<uint32_t>();
+    }
+
+    if (result.count("stream-threads")) {
+        streamingThreads = result["stream-threads"].as<uint32_t>();
+    }
+
+    if (result.count("io-threads")) {
+        ioThreads = result["io-threads"].as<uint32_t>();
+    }
+
+    if (result.count("write-behind")) {
+        writeBehindBytes = static_cast<size_t>(result["write-behind"].as<uint32_t>()) << 20;
+    }
+
+    if (result.count("chunk-cache")) {
+        chunkCacheBytes = static_cast<size_t>(result["chunk-cache"].as<uint32_t>()) << 20;
+    }
+
+    if (result.count("prefetch")) {
+        prefetchSeconds = std::max(result["prefetch"].as<float>(), 0.0f);
+    }
+
+    if (result.count("lod-hysteresis")) {
+        lodHysteresis = std::max(result["lod-hysteresis"].as<float>(), 0.0f);
+    }
+
+    if (result.count("lod-residency")) {
+        lodMinResidencySeconds = std::max(result["lod-residency"].as<float>(), 0.0f);
+    }
+
+    if (result.count("offscreen-lod")) {
+        offscreenLodLevels = result["offscreen-lod"].as<uint32_t>();
+    }
+
+    if (result.count("pixel-error")) {
+        pixelError = std::max(result["pixel-error"].as<float>(), 0.01f);
+    }
+    if (result.count("resolution")) {
+        auto resolution = result["resolution"].as<std::string>();
+        if (sscanf(resolution.c_str(), "%ux%u", &width, &height) != 2 || width == 0 || height == 0) {
+            spdlog::error("Invalid resolution {}, expected WIDTHxHEIGHT", resolution);
+            exit(1);
+        }
+    }
+    if (result.count("frustum-guard")) {
+        frustumGuardDegrees = std::max(result["frustum-guard"].as<float>(), 0.0f);
+    }
+
+    traversalFeedback = result.count("traversal-feedback") > 0;
+
+    if (result.count("frame-target")) {
+        uploadTargetFrameMs = std::max(result["frame-target"].as<double>(), 0.0);
+    }
+
+    if (result.count("upload-budget")) {
+        uploadBudgetBytes = static_cast<size_t>(result["upload-budget"].as<uint32_t>()) << 20;
+    }
+
+    if (result.count("upload-chunks")) {
+        uploadBudgetChunks = result["upload-chunks"].as<uint32_t>();
+    }
+
+    if (result.count("compaction-budget")) {
+        compactionBytesPerFrame = static_cast<size_t>(result["compaction-budget"].as<uint32_t>()) << 20;
+    }
+
+    if (result.count("compaction-threshold")) {
+        compactionThreshold = std::clamp(result["compaction-threshold"].as<float>(), 0.0f, 1.0f);
+    }
+
+    if (result.count("octree-pool")) {
+        octreePoolMaxBytes = static_cast<size_t>(result["octree-pool"].as<uint32_t>()) << 20;
+    }
+
+    bindlessChunks = result.count("bindless-chunks") > 0;
+    if (result.count("bindless-spare")) {
+        bindlessSpareBytes = static_cast<size_t>(result["bindless-spare"].as<uint32_t>()) << 20;
+    }
+    if (result.count("gpu-budget")) {
+        gpuMemoryBudgetBytes = static_cast<size_t>(result["gpu-budget"].as<uint32_t>()) << 20;
+    }
+
+    if (result.count("overview")) {
+        overviewSize = result["overview"].as<uint32_t>();
+    }
+    if (overviewSize != 0 && overviewSize % 2 == 0) {
+        //Centered on the camera chunk like the grid
+        overviewSize++;
+    }
+
+    if (result.count("overview-res")) {
+        overviewResolution = std::clamp(std::bit_ceil(result["overview-res"].as<uint32_t>()), 1u, chunk_resolution);
+    }
+
+
     if (grid_height > grid_size / 2) {
         //Todo!: Fix chunkload logic to properly account for any gridheight :)
         spdlog::error("Grid Height is too high compared to grid Size, might not load every chunk properly!");
@@ -24,7 +24,20 @@ struct Config {
     //Whether we use the voxelizer or the heightmap data.
     bool useHeightmapData = true;
     float voxelscale = 0.0155f;
-    float scaleDistance = 10.0f; //At what distance would the voxelScale be equivalent to a pixel? TODO: calculate this automagically
+    //Pixels a voxel may cover on screen before its chunk gets loaded finer, the LOD follows from this, fov and height
+    float pixelError = 1.0f;
+    //LOD levels a chunk may be off from its wanted resolution before it gets reloaded, and the minimum time a chunk
+    //stays in its grid slot before its resolution may change
+    float lodHysteresis = 0.25f;
+    float lodMinResidencySeconds = 1.0f;
+    //LOD levels coarser that chunks outside the view get loaded at, primary rays never reach them and the sun rays
+    //do fine with coarse data. The guard band widens the view so turning around does not show coarse chunks straight
+    //away. 0 levels loads every chunk by distance only, which is the default, --offscreen-lod turns it on
+    uint32_t offscreenLodLevels = 0;
+    float frustumGuardDegrees = 20.0f;
+    //Load chunks at the resolution the rays that enter them need, read back from the shader, instead of by distance
+    //only. Never finer than by distance and at most offscreenLodLevels coarser
+    bool traversalFeedback = false;
 
     //Output screen size
     uint32_t width = 1920;
@@ -36,6 +49,40 @@ struct Config {
     size_t GIGABYTE = (1 << 30);
 
     VkDeviceSize staging_size = GIGABYTE << 1;
+    //Threads loading chunks for the streaming grid
+    uint32_t streamingThreads = 4;
+    //Amount of chunk reads kept in flight, and threads used for them when io_uring is not available
+    uint32_t ioQueueDepth = 32;
+    uint32_t ioThreads = 4;
+    //Max amount of generated chunk data waiting to be written to disk before writes get dropped
+    size_t writeBehindBytes = GIGABYTE >> 1;
+    //Host memory kept for recently used chunks, 0 disables the cache
+    size_t chunkCacheBytes = GIGABYTE;
+    //How far ahead the camera position is predicted to load chunks into the cache early, 0 disables prefetching
+    float prefetchSeconds = 1.0f;
+    //Frame time the upload budget adapts to, 0 keeps it at the maximum below
+    double uploadTargetFrameMs = 1000.0 / 60.0;
+    //Max bytes and chunk table entries uploaded in a single frame, the rest waits for later frames
+    size_t uploadBudgetBytes = 64 << 20;
+    uint32_t uploadBudgetChunks = 64;
+    //Bytes of chunk data the compaction may move per frame once a GPU pool has more than compactionThreshold of its
+    //free memory outside the largest free block, 0 disables compaction
+    size_t compactionBytesPerFrame = 4 << 20;
+    float compactionThreshold = 0.5f;
+    //Max bytes of octree buffers, more get created as the chunks need them. 0 uses half of the largest device local heap
+    size_t octreePoolMaxBytes = 0;
+    //Give every chunk an octree buffer of its own, bound by descriptor index, instead of sharing the pool buffers.
+    //Freed buffers up to bindlessSpareBytes are kept for reuse.
+    bool bindlessChunks = false;
+    size_t bindlessSpareBytes = 256 << 20;
+    //Bytes of chunk data the grid may keep on the GPU, the least important chunks get loaded coarser or evicted to stay
+    //below it. 0 only makes room when an allocation fails
+    size_t gpuMemoryBudgetBytes = 0;
+    //Chunks across of the low resolution overview drawn where the grid has no chunk yet and past the grid, follows the
+    //camera like the grid does. 0 disables the overview, which is the default as it costs overviewSize^2 *
+    //grid_height extra chunks to load and generate.
+    uint32_t overviewSize = 0;
+    uint32_t overviewResolution = 8;
     uint32_t chunk_resolution = 1024;
     uint32_t grid_size = 31;
     uint32_t grid_height = useHeightmapData
@@ -56,6 +103,16 @@ struct Config {
     std::string camera_keyframe_path = "./camera_path.json";
 
     bool chunkgen = false;
+    //Worker threads used by chunkgen, 0 uses every core
+    uint32_t chunkgenThreads = 0;
+    //Only print what chunkgen would generate
+    bool chunkgenPlanOnly = false;
+    //Chunkgen only generates its own part of the plan when split over shardCount processes
+    uint32_t shardIndex = 0;
+    uint32_t shardCount = 1;
+    bool mergeShards = false;
+    //Only benchmark the GPU pool allocators with this many resident chunks, 0 runs the application
+    uint32_t allocatorBenchmarkChunks = 0;
     bool allowUserInput = true;
     bool printChunkDebug = false;
     spdlog::level::level_enum loglevel = spdlog::level::debug;
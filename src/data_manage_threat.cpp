@@ -20,32 +20,31 @@
 
 BufferManager::BufferManager(VkBuffer &buffer, VkDeviceSize bufferSize, const std::string &name,
                              size_t itemSize) : buffer(buffer),
-                                                bufferSize(bufferSize), name(name), itemSize(itemSize) {
-    this->chunks = std::vector<DataChunk>();
-    //Initial offset is 1, so 0 can be reserved as a special value
-    this->chunks.emplace_back(1, bufferSize - 1, false);
+                                                bufferSize(bufferSize), allocator(bufferSize), name(name),
+                                                itemSize(itemSize) {
 }
 
 inline double bytesToMB(std::size_t bytes) {
     return static_cast<double>(bytes) / (1024.0 * 1024.0);
 }
 
+inline int positive_mod(int a, int b) {
+    return (a % b + b) % b;
+}
+
 void BufferManager::printBufferInfo() {
-    size_t occupied_memory = 0;
-    size_t free_memory = 0;
-    for (auto it = chunks.begin(); it != chunks.end(); ++it) {
-        if (it->occupied) {
-            occupied_memory += it->elementSize * itemSize;
-        } else {
-            free_memory += it->elementSize * itemSize;
-        }
-    }
+    std::lock_guard<std::mutex> lock(mut);
+    size_t occupied_memory = allocator.used() * itemSize;
+    size_t free_memory = (allocator.capacity() - allocator.used()) * itemSize;
     size_t totalSize = occupied_memory + free_memory;
     float percentage_free = occupied_memory / static_cast<float>(totalSize) * 100.0f;
     spdlog::info("{} Memory used: {:.2f} MB, Memory Free: {:.2f} MB, Percentage used {:.2f}%", name,
                  bytesToMB(occupied_memory),
                  bytesToMB(free_memory),
                  percentage_free);
+    spdlog::info("{} Largest free block: {:.2f} MB, {} free blocks, {:.1f}% external fragmentation", name,
+                 bytesToMB(allocator.largestFree() * itemSize), allocator.freeBlocks(),
+                 allocator.externalFragmentation() * 100.0);
 }
 
 size_t BufferManager::allocateChunk(size_t size) {
@@ -55,89 +54,71 @@ size_t BufferManager::allocateChunk(size_t size) {
         return 0;
     }
 
-    auto best = chunks.end();
-    size_t bestSize = bufferSize + 1;
-    for (auto it = chunks.begin(); it != chunks.end(); ++it) {
-        if (!it->occupied && it->elementSize >= size && it->elementSize < bestSize) {
-            best = it;
-            bestSize = it->elementSize;
-        }
-    }
-
-    if (best == chunks.end()) {
+    size_t offset = allocator.allocate(size);
+    if (offset == 0) {
         std::cerr << "No possible location to allocate Chunk!" << std::endl;
-        return 0;
-    }
-
-    size_t remaining_area = bestSize - size;
-    size_t offset = best->offset;
-    best->elementSize = size;
-    best->occupied = true;
-    if (remaining_area > 0) {
-        chunks.emplace(std::next(best), offset + size, remaining_area, false);
     }
+    return offset;
+}
 
+size_t BufferManager::allocateChunkBelow(size_t size, size_t limit) {
+    std::lock_guard<std::mutex> lock(mut);
+    return allocator.allocateBelow(size, limit);
+}
 
-    return offset;
+double BufferManager::fragmentation() {
+    std::lock_guard<std::mutex> lock(mut);
+    return allocator.externalFragmentation();
 }
 
 void BufferManager::freeChunk(size_t offset) {
     std::lock_guard<std::mutex> lock(mut);
-    auto chunk = chunks.end();
-    for (auto it = chunks.begin(); it != chunks.end(); ++it) {
-        if (it->offset == offset) {
-            chunk = it;
-            break;
-        }
-    }
-
-    if (chunk == chunks.end()) {
+    if (!allocator.free(offset)) {
         std::cerr << "Tried to free an offset that is not allocated!" << std::endl;
-        return;
-    }
-
-    //Check if prev and next are free, if so, merge them into one
-    auto first = chunk;
-    auto last = chunk;
-    auto newSize = chunk->elementSize;
-    if (chunk != chunks.begin() && !std::prev(chunk)->occupied) {
-        first = std::prev(chunk);
-        newSize += first->elementSize;
-    }
-    if (std::next(chunk) != chunks.end() && !std::next(chunk)->occupied) {
-        last = std::next(chunk);
-        newSize += last->elementSize;
-    }
-    first->occupied = false;
-    first->elementSize = newSize;
-
-    if (first != last) {
-        //Next on first because we replace first not remove it, next on last because [__first,__last).
-        chunks.erase(std::next(first), std::next(last));
     }
 }
 
 
 DataManageThreat::DataManageThreat(VkDevice &device, StagingBufferProperties &stagingBufferProperties, Config &config,
-                                   BufferManager &octreeGPUManager, BufferManager &stagingBufferManager,
+                                   OctreePool &octreeGPUManager, StagingRing &stagingRing,
                                    VkBuffer &chunkBuffer, BufferManager &farValuesManager,
                                    std::optional<SceneMetadata> objFileData,
                                    std::vector<CpuChunk> &chunks,
                                    CPUCamera &camera)
 
-    : stopFlag(false),
-      config(config),
+    : config(config),
       stagingBufferProperties(stagingBufferProperties),
       chunks(chunks),
       camera(camera),
       device(device),
-      stagingBufferManager(stagingBufferManager),
+      stagingRing(stagingRing),
       octreeGPUManager(octreeGPUManager),
       farValuesManager(farValuesManager),
       chunkBuffer(chunkBuffer),
-      objSceneData(objFileData) {
+      stopFlag(false),
+      slotGenerations(chunks.size() +
+                      static_cast<size_t>(config.grid_height) * config.overviewSize * config.overviewSize),
+      slotTargets(slotGenerations.size(), ChunkKey{glm::ivec3(0), 0}),
+      overviewChunks(slotGenerations.size() - chunks.size()),
+      lastCameraChunk(camera.chunk_coords),
+      slotResidentSince(chunks.size()),
+      slotPreviousResolution(chunks.size(), 0),
+      lastPrefetchChunk(camera.chunk_coords),
+      slotMissing(chunks.size(), false),
+      shellTable(config.grid_size, config.grid_height, config.chunk_resolution, ScreenSpaceError(config),
+                 config.lodHysteresis),
+      slotChanged(chunks.size(), false),
+      uploadBudget(config.uploadTargetFrameMs, config.uploadBudgetBytes, config.uploadBudgetChunks),
+      residency(config.gpuMemoryBudgetBytes, chunks.size(), MIN_CHUNK_RESOLUTION, config.chunk_resolution),
+      traversalFeedback(chunks.size()),
+      objSceneData(objFileData),
+      chunkReader(config.ioQueueDepth, config.ioThreads),
+      chunkCache(config.chunkCacheBytes) {
     spdlog::debug("Staging buffer size: {}", stagingBufferProperties.bufferSize);
-    workerThread = std::thread([this]() { this->threadLoop(); });
+    ScreenSpaceError lodError(config);
+    spdlog::info("LOD: voxels up to {} px at {}x{}, chunks past {:.1f} chunks get coarser", config.pixelError,
+                 config.width, config.height,
+                 1.0f + 2.0f / (lodError.pixelAngle * lodError.pixelError * static_cast<float>(config.chunk_resolution)));
     if (objSceneData.has_value()) {
         objFile = objSceneData->objFile;
     } else {
@@ -147,12 +128,27 @@ DataManageThreat::DataManageThreat(VkDevice &device, StagingBufferProperties &st
     fs::path filePath{objFile};
     this->objDirectory = filePath.parent_path().string();
     this->directory = std::format("{}_{}", (filePath.parent_path() / filePath.stem()).string(), config.grid_size);
+    chunkWriter = std::make_unique<ChunkWriteQueue>(directory, config.chunk_resolution, config.writeBehindBytes);
     // loadObj();
-    initFence();
-    initCommandBuffers();
+    initUploadPipeline();
 
     vkMapMemory(device, stagingBufferProperties.pStagingBufferMemory, 0, stagingBufferProperties.bufferSize, 0,
                 &gpuDataPointer);
+
+    //Workers wait for finished reads together with new jobs, so a job never waits on an unrelated read
+    chunkReader.setCompletionListener([this]() {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        cv.notify_one();
+    });
+
+    //Only start the workers once everything they use is set up
+    uint32_t workerCount = std::max(config.streamingThreads, 1u);
+    for (uint32_t i = 0; i < workerCount; i++) {
+        workers.push_back(std::make_unique<StreamingWorker>());
+    }
+    for (auto &worker: workers) {
+        worker->thread = std::thread([this, &worker = *worker]() { this->threadLoop(worker); });
+    }
 }
 
 DataManageThreat::~DataManageThreat() {
@@ -160,288 +156,1134 @@ DataManageThreat::~DataManageThreat() {
     {
         std::lock_guard<std::mutex> lock(queueMutex);
         stopFlag = true;
+        //Nothing waits on these, so do not keep the workers busy with them
+        overviewQueue.clear();
+        prefetchQueue.clear();
     }
     cv.notify_all();
-    workerThread.join();
+    for (auto &worker: workers) {
+        worker->thread.join();
+    }
 
-    for (const auto &[key, value]: textures) {
-        stbi_image_free(value.imageData);
+    for (auto &worker: workers) {
+        for (const auto &[key, value]: worker->textures) {
+            stbi_image_free(value.imageData);
+        }
     }
 
-    vkDestroyFence(device, transferFence, nullptr);
-    vkFreeCommandBuffers(device, threadCommandPool, 1, &threadCommandBuffer);
-    vkDestroyCommandPool(device, threadCommandPool, nullptr);
+    uint64_t waitValue = uploadTimelineValue;
+    VkSemaphoreWaitInfo waitInfo{};
+    waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    waitInfo.semaphoreCount = 1;
+    waitInfo.pSemaphores = &uploadTimeline;
+    waitInfo.pValues = &waitValue;
+    vkWaitSemaphores(device, &waitInfo, UINT64_MAX);
+    vkFreeCommandBuffers(device, stagingBufferProperties.transferCommandPool,
+                         static_cast<uint32_t>(uploadCommandBuffers.size()), uploadCommandBuffers.data());
+    vkDestroySemaphore(device, uploadTimeline, nullptr);
+}
+
+uint32_t DataManageThreat::slotIndex(glm::ivec3 gridCoord) const {
+    return gridCoord.z * config.grid_size * config.grid_size + gridCoord.y * config.grid_size + gridCoord.x;
+}
+
+uint32_t DataManageThreat::overviewIndex(glm::ivec3 overviewCoord) const {
+    return static_cast<uint32_t>(chunks.size()) + overviewCoord.z * config.overviewSize * config.overviewSize +
+           overviewCoord.y * config.overviewSize + overviewCoord.x;
+}
+
+uint32_t DataManageThreat::slotIndex(const ChunkLoadInfo &job) const {
+    return job.overview ? overviewIndex(job.gridCoord) : slotIndex(job.gridCoord);
+}
+
+CpuChunk &DataManageThreat::slotChunk(uint32_t chunkIdx) {
+    return chunkIdx < chunks.size() ? chunks[chunkIdx] : overviewChunks[chunkIdx - chunks.size()];
+}
+
+bool DataManageThreat::isCurrent(const ChunkLoadInfo &job) const {
+    return slotGenerations[slotIndex(job)].load() == job.generation;
 }
 
-void DataManageThreat::pushWork(ChunkLoadInfo job) { {
+void DataManageThreat::pushWork(ChunkLoadInfo job, const CpuChunk &current) {
+    uint32_t chunkIdx = slotIndex(job.gridCoord);
+    ChunkKey target{job.chunkCoord, job.resolution};
+    if (slotTargets[chunkIdx] == target) {
+        //Already queued or being loaded
+        return;
+    }
+    if (slotTargets[chunkIdx].chunkCoord != job.chunkCoord) {
+        traversalFeedback.reset(chunkIdx);
+    }
+    slotTargets[chunkIdx] = target;
+    if (current.resolution != 0 && current.chunk_coords == job.chunkCoord) {
+        auto now = std::chrono::steady_clock::now();
+        lodChanges.push_back(now);
+        if (job.resolution == slotPreviousResolution[chunkIdx]) {
+            lodFlips.push_back(now);
+        }
+        slotPreviousResolution[chunkIdx] = current.resolution;
+    } else {
+        slotPreviousResolution[chunkIdx] = 0;
+    }
+    //Whatever was still queued or running for this slot is stale from here on.
+    job.generation = ++slotGenerations[chunkIdx];
+    if (changeLODInPlace(job, current)) {
+        return;
+    }
+
+    float lodDelta = MISSING_CHUNK_LOD_DELTA;
+    if (current.resolution != 0 && current.chunk_coords == job.chunkCoord) {
+        lodDelta = std::abs(std::log2(static_cast<float>(job.resolution)) -
+                            std::log2(static_cast<float>(current.resolution)));
+    }
+    float priority = chunkPriority(job.chunkCoord - camera.chunk_coords, camera.gpu_camera.direction, lodDelta,
+                                   job.outsideView); {
         std::lock_guard<std::mutex> lock(queueMutex);
-        workQueue.push(job);
+        workQueue.push_back({job, lodDelta, priority});
+        std::push_heap(workQueue.begin(), workQueue.end());
     }
     cv.notify_one(); // wake the thread
 }
 
+bool DataManageThreat::changeLODInPlace(const ChunkLoadInfo &job, const CpuChunk &current) {
+    //Breadth first trees have every level after the previous one, so the first levels are the same chunk at a lower
+    //resolution. The node colors uploaded with the tree give the cut off nodes their color.
+    if (current.treeLevels == 0 || current.rootNodeIndex == 0 || current.chunk_coords != job.chunkCoord ||
+        job.resolution > current.treeResolution) {
+        return false;
+    }
+    uint32_t droppedLevels = std::countr_zero(current.treeResolution) - std::countr_zero(job.resolution);
+    if (droppedLevels >= current.treeLevels) {
+        return false;
+    }
+    //The main thread does not wait for staging memory, without room the chunk just gets loaded normally.
+    size_t chunkIndex = stagingRing.allocateChunk(sizeof(Chunk), std::chrono::milliseconds(0));
+    if (chunkIndex == 0) {
+        return false;
+    }
+    uint32_t maxDepth = droppedLevels == 0 ? UINT32_MAX : current.treeLevels - 1 - droppedLevels;
+    auto chunkGpu = Chunk{
+        current.ChunkFarValuesOffset, octreeGPUManager.shaderRoot(current.rootNodeIndex), maxDepth,
+        current.colorsOffset, current.chunk_coords, octreeGPUManager.shaderBuffer(current.rootNodeIndex)
+    };
+    memcpy(static_cast<uint8_t *>(gpuDataPointer) + chunkIndex, &chunkGpu, sizeof(Chunk));
+
+    CpuChunk newChunk = current;
+    newChunk.resolution = job.resolution;
+    newChunk.loading = false;
+    {
+        std::lock_guard<std::mutex> lock(transferQueueMutex);
+        transferQueue.push({slotIndex(job.gridCoord), job.generation, chunkIndex, 0, 0, newChunk, true});
+    }
+    //Every level has about four times the nodes of the one above it for a surface, so that is roughly what a chunk
+    //file of the new resolution would have been.
+    inPlaceLODChanges++;
+    inPlaceBytesSaved += ((static_cast<uint64_t>(current.chunkSize) + current.offsetSize) * sizeof(uint32_t)) >>
+            (2 * droppedLevels);
+    return true;
+}
+
+void DataManageThreat::cancelWork(uint32_t chunkIdx, CpuChunk &current) {
+    slotTargets[chunkIdx] = ChunkKey{current.chunk_coords, current.resolution};
+    ++slotGenerations[chunkIdx];
+    current.loading = false;
+}
+
+void DataManageThreat::relieveMemoryPressure() {
+    auto resident = [this]() {
+        std::vector<ResidentChunk> candidates;
+        for (uint32_t chunkIdx = 0; chunkIdx < chunks.size(); chunkIdx++) {
+            const CpuChunk &chunk = chunks[chunkIdx];
+            //A slot still loading has its memory referenced by a job or transfer.
+            if (!chunk.loading && (chunk.rootNodeIndex != 0 || chunk.ChunkFarValuesOffset != 0)) {
+                candidates.push_back({
+                    chunkIdx, chunk.chunk_coords, chunk.resolution,
+                    (static_cast<size_t>(chunk.chunkSize) + chunk.offsetSize) * sizeof(uint32_t)
+                });
+            }
+        }
+        return candidates;
+    };
+    glm::vec3 viewDirection = camera.gpu_camera.direction;
+    glm::ivec3 center = camera.gpu_camera.camera_grid_pos;
+    auto importance = [this, viewDirection, center](glm::ivec3 chunkCoord) {
+        glm::ivec3 offset = chunkCoord - camera.chunk_coords;
+        //Chunks no ray entered lately, hidden behind others, go before visible ones
+        uint32_t chunkIdx = slotIndex(glm::ivec3(positive_mod(center.x + offset.x, static_cast<int>(config.grid_size)),
+                                                 positive_mod(center.y + offset.y, static_cast<int>(config.grid_size)),
+                                                 chunkCoord.z));
+        return chunkPriority(offset, viewDirection, 0.0f, feedbackResolution(chunkIdx) == 0);
+    };
+    for (uint32_t chunkIdx: residency.update(resident, gridResidentBytes, importance)) {
+        if (!evictSlot(chunkIdx, chunks[chunkIdx].chunk_coords)) {
+            //Its cap stays, checkChunks evicts it once there is staging memory.
+            break;
+        }
+    }
+}
+
+uint32_t DataManageThreat::residencyCap(uint32_t chunkIdx, glm::ivec3 chunkCoord, uint32_t resolution) const {
+    return residency.cap(chunkIdx, chunkCoord, resolution);
+}
+
+void DataManageThreat::keepEmpty(uint32_t chunkIdx, glm::ivec3 chunkCoord, CpuChunk &current) {
+    if (slotTargets[chunkIdx] == ChunkKey{chunkCoord, 0}) {
+        //Evicted already, or the eviction is on its way
+        return;
+    }
+    if (current.rootNodeIndex == 0 && current.ChunkFarValuesOffset == 0 && current.chunk_coords == chunkCoord &&
+        current.resolution == 0) {
+        cancelWork(chunkIdx, current);
+        return;
+    }
+    if (!evictSlot(chunkIdx, chunkCoord)) {
+        markSlotChanged(chunkIdx);
+    }
+}
+
+bool DataManageThreat::evictSlot(uint32_t chunkIdx, glm::ivec3 chunkCoord) {
+    size_t chunkIndex = stagingRing.allocateChunk(sizeof(Chunk), std::chrono::milliseconds(0));
+    if (chunkIndex == 0) {
+        return false;
+    }
+    auto chunkGpu = Chunk(0, 0, UINT32_MAX, 0, NO_CHUNK_COORDS);
+    memcpy(static_cast<uint8_t *>(gpuDataPointer) + chunkIndex, &chunkGpu, sizeof(Chunk));
+
+    //Goes through the transfer loop like an in place LOD change, which frees the memory of what the slot held. The
+    //slot counts as loading until then so nothing else touches that memory.
+    CpuChunk &current = chunks[chunkIdx];
+    slotTargets[chunkIdx] = ChunkKey{chunkCoord, 0};
+    uint32_t generation = ++slotGenerations[chunkIdx];
+    current.loading = true;
+    CpuChunk newChunk{};
+    newChunk.chunk_coords = chunkCoord;
+    {
+        std::lock_guard<std::mutex> lock(transferQueueMutex);
+        transferQueue.push({chunkIdx, generation, chunkIndex, 0, 0, newChunk, true});
+    }
+    return true;
+}
+
+bool DataManageThreat::evictionPending(uint32_t chunkIdx) const {
+    return chunks[chunkIdx].loading && slotTargets[chunkIdx].resolution == 0;
+}
+
+void DataManageThreat::markSlotChanged(uint32_t chunkIdx) {
+    if (chunkIdx < chunks.size() && !slotChanged[chunkIdx]) {
+        slotChanged[chunkIdx] = true;
+        changedSlots.push_back(chunkIdx);
+    }
+}
+
+bool DataManageThreat::takeChangedSlots(std::vector<uint32_t> &slots) {
+    for (uint32_t chunkIdx: residency.takeChangedCaps()) {
+        markSlotChanged(chunkIdx);
+    }
+    auto now = std::chrono::steady_clock::now();
+    while (!lodRechecks.empty() && lodRechecks.top().first <= now) {
+        markSlotChanged(lodRechecks.top().second);
+        lodRechecks.pop();
+    }
+    slots.clear();
+    slots.swap(changedSlots);
+    for (uint32_t chunkIdx: slots) {
+        slotChanged[chunkIdx] = false;
+    }
+    //Chunks cross the edge of the view cone once the camera turned by about half the guard band.
+    glm::vec3 direction = glm::normalize(camera.gpu_camera.direction);
+    float turnLimit = glm::radians(std::max(config.frustumGuardDegrees * 0.5f, 2.0f));
+    bool turned = config.offscreenLodLevels > 0 && glm::dot(direction, lastCheckedDirection) < std::cos(turnLimit);
+    if (lastCheckedChunk == camera.chunk_coords && !turned) {
+        return false;
+    }
+    lastCheckedChunk = camera.chunk_coords;
+    lastCheckedDirection = direction;
+    return true;
+}
+
+void DataManageThreat::applyTraversalFeedback(const uint32_t *values) {
+    if (!config.traversalFeedback) {
+        return;
+    }
+    for (uint32_t chunkIdx: traversalFeedback.update(values)) {
+        markSlotChanged(chunkIdx);
+    }
+}
+
+uint32_t DataManageThreat::feedbackResolution(uint32_t chunkIdx) const {
+    return config.traversalFeedback ? traversalFeedback.neededResolution(chunkIdx) : UINT32_MAX;
+}
+
+ViewCone DataManageThreat::viewCone() const {
+    const Camera &view = camera.gpu_camera;
+    return ViewCone(view.position / static_cast<float>(camera.maxChunkResolution), view.direction, view.fov,
+                    view.resolution.x / view.resolution.y, glm::radians(config.frustumGuardDegrees));
+}
+
+void DataManageThreat::recheckWhenLodChangeAllowed(uint32_t chunkIdx) {
+    auto allowedAt = slotResidentSince[chunkIdx] + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                         std::chrono::duration<float>(config.lodMinResidencySeconds));
+    lodRechecks.emplace(allowedAt, chunkIdx);
+}
+
+bool DataManageThreat::lodChangeAllowed(uint32_t chunkIdx) const {
+    auto resident = std::chrono::steady_clock::now() - slotResidentSince[chunkIdx];
+    return std::chrono::duration<float>(resident).count() >= config.lodMinResidencySeconds;
+}
+
+void DataManageThreat::rescoreWork() {
+    if (camera.chunk_coords == lastCameraChunk) {
+        return;
+    }
+    lastCameraChunk = camera.chunk_coords;
+    glm::vec3 viewDirection = camera.gpu_camera.direction;
+    std::lock_guard<std::mutex> lock(queueMutex);
+    //Stale jobs would be skipped when popped anyway, but no need to keep them around.
+    size_t before = workQueue.size();
+    std::erase_if(workQueue, [this](const QueuedChunk &queued) { return !isCurrent(queued.job); });
+    cancelledJobs += before - workQueue.size();
+    for (auto &queued: workQueue) {
+        queued.priority = chunkPriority(queued.job.chunkCoord - lastCameraChunk, viewDirection, queued.lodDelta,
+                                        queued.job.outsideView);
+    }
+    std::make_heap(workQueue.begin(), workQueue.end());
+}
+
+void CameraMotion::update(glm::vec3 position, double time) {
+    double dt = time - lastTime;
+    if (lastTime >= 0.0 && dt > 0.0) {
+        //Smooth over a few frames so a single jittery frame does not send the prediction somewhere else.
+        glm::vec3 frameVelocity = (position - lastPosition) / static_cast<float>(dt);
+        velocity = glm::mix(velocity, frameVelocity, 0.2f);
+    }
+    lastPosition = position;
+    lastTime = time;
+}
+
+void DataManageThreat::prefetch(glm::ivec3 predictedChunk) {
+    if (!chunkCache.enabled() || predictedChunk == lastPrefetchChunk) {
+        return;
+    }
+    lastPrefetchChunk = predictedChunk;
+
+    std::vector<ChunkKey> keys;
+    if (predictedChunk != camera.chunk_coords) {
+        //What the grid needs right now already gets loaded by the regular jobs. Same bands as the chunk planner, so the
+        //resolutions within the hysteresis and the coarser ones for cells outside the view get prefetched too.
+        ChunkKeySet current, predicted;
+        addChunksAroundCamera(camera.chunk_coords, config, current, config.lodHysteresis, config.offscreenLodLevels);
+        addChunksAroundCamera(predictedChunk, config, predicted, config.lodHysteresis, config.offscreenLodLevels);
+        for (const auto &key: predicted) {
+            if (!current.contains(key)) {
+                keys.push_back(key);
+            }
+        }
+        auto distance = [predictedChunk](const ChunkKey &key) {
+            return glm::length(glm::vec3(key.chunkCoord - predictedChunk));
+        };
+        std::sort(keys.begin(), keys.end(), [&](const ChunkKey &a, const ChunkKey &b) {
+            return distance(a) < distance(b);
+        });
+    } {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        prefetchQueue.assign(keys.begin(), keys.end());
+    }
+    cv.notify_all();
+}
+
+void DataManageThreat::recordFrame() {
+    frames++;
+    framesMissingChunks += missingSlots > 0;
+}
+
+void DataManageThreat::setSlotMissing(uint32_t chunkIdx, bool missing) {
+    if (slotMissing[chunkIdx] != missing) {
+        slotMissing[chunkIdx] = missing;
+        missingSlots += missing ? 1 : -1;
+    }
+}
+
+void DataManageThreat::updateOverview() {
+    if (config.overviewSize == 0 || lastOverviewChunk == camera.chunk_coords) {
+        return;
+    }
+    lastOverviewChunk = camera.chunk_coords;
+
+    //Moving a chunk only changes one row of the overview, everything else already holds or loads the right chunk.
+    std::vector<ChunkLoadInfo> jobs;
+    int rd = int((config.overviewSize - 1) / 2);
+    for (int z = 0; z < int(config.grid_height); z++) {
+        for (int dy = -rd; dy <= rd; dy++) {
+            for (int dx = -rd; dx <= rd; dx++) {
+                glm::ivec3 chunkCoord{camera.chunk_coords.x + dx, camera.chunk_coords.y + dy, z};
+                glm::ivec3 overviewCoord{
+                    positive_mod(chunkCoord.x, int(config.overviewSize)),
+                    positive_mod(chunkCoord.y, int(config.overviewSize)), z
+                };
+                uint32_t chunkIdx = overviewIndex(overviewCoord);
+                ChunkKey target{chunkCoord, config.overviewResolution};
+                if (slotTargets[chunkIdx] == target) {
+                    continue;
+                }
+                slotTargets[chunkIdx] = target;
+                jobs.push_back({
+                    overviewCoord, config.overviewResolution, chunkCoord, ++slotGenerations[chunkIdx], true
+                });
+            }
+        }
+    }
+    auto distance = [this](const ChunkLoadInfo &job) {
+        return glm::length(glm::vec3(job.chunkCoord - camera.chunk_coords));
+    };
+    std::sort(jobs.begin(), jobs.end(), [&](const ChunkLoadInfo &a, const ChunkLoadInfo &b) {
+        return distance(a) < distance(b);
+    }); {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        std::erase_if(overviewQueue, [this](const ChunkLoadInfo &job) { return !isCurrent(job); });
+        overviewQueue.insert(overviewQueue.end(), jobs.begin(), jobs.end());
+    }
+    cv.notify_all();
+}
+
 bool DataManageThreat::CheckToWaitAndStartTransfer() {
-    if (!chunkDeleteQueue.empty()) {
-        //Free the memory on the staging buffer for the chunks that got transfered in the previous frame.
-        //Shouldnt be possible but wait before freeing from staging buffer just in case.
-        vkWaitForFences(device, 1, &gridFence, VK_TRUE, UINT64_MAX);
-        vkResetFences(device, 1, &gridFence);
-        while (!chunkDeleteQueue.empty()) {
-            TransferInformation info = chunkDeleteQueue.front();
-            chunkDeleteQueue.pop();
-            stagingBufferManager.freeChunk(info.staging_offset);
+    //Called once per frame
+    uploadBudget.beginFrame();
+
+    //Free the staging memory of every batch the GPU is done copying from, without waiting on anything.
+    uint64_t completedValue = 0;
+    vkGetSemaphoreCounterValue(device, uploadTimeline, &completedValue);
+    while (!retiringStaging.empty() && retiringStaging.front().timelineValue <= completedValue) {
+        for (size_t offset: retiringStaging.front().stagingOffsets) {
+            stagingRing.freeChunk(offset);
         }
+        for (size_t offset: retiringStaging.front().octreeOffsets) {
+            octreeGPUManager.freeChunk(offset);
+        }
+        for (size_t offset: retiringStaging.front().farValuesOffsets) {
+            farValuesManager.freeChunk(offset);
+        }
+        retiringStaging.pop_front();
     }
 
     std::lock_guard<std::mutex> lock(transferQueueMutex);
-    if (!transferQueue.empty()) {
-        VkCommandBufferBeginInfo beginInfo{};
-        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-        vkResetCommandBuffer(stagingBufferProperties.transferCommandBuffer, 0);
-        vkBeginCommandBuffer(stagingBufferProperties.transferCommandBuffer, &beginInfo);
-
-        while (!transferQueue.empty()) {
-            TransferInformation info = transferQueue.front();
-            transferQueue.pop();
-            VkBufferCopy copyRegion{};
-            copyRegion.srcOffset = info.staging_offset;
-            copyRegion.dstOffset = info.chunk_idx * sizeof(Chunk);
-            copyRegion.size = sizeof(Chunk);
-            vkCmdCopyBuffer(stagingBufferProperties.transferCommandBuffer, stagingBufferProperties.pStagingBuffer,
-                            chunkBuffer, 1, &copyRegion);
+    for (auto [chunkIdx, generation]: releasedSlots) {
+        //If the slot got a new target since, that job owns the slot now.
+        if (slotGenerations[chunkIdx].load() == generation) {
+            CpuChunk &chunk = slotChunk(chunkIdx);
+            chunk.loading = false;
+            slotTargets[chunkIdx] = ChunkKey{chunk.chunk_coords, chunk.resolution};
+            markSlotChanged(chunkIdx);
+        }
+    }
+    releasedSlots.clear();
 
-            CpuChunk &chunk = chunks[info.chunk_idx];
+    bool compact = compactionDue();
+    if (transferQueue.empty() && !compact) {
+        return false;
+    }
 
-            if (chunk.rootNodeIndex != 0) {
-                octreeGPUManager.freeChunk(chunk.rootNodeIndex);
+    //Take a command buffer the GPU is done with, if they are all still in flight try again next frame.
+    size_t batchIndex = 0;
+    while (batchIndex < UPLOAD_BATCHES_IN_FLIGHT && uploadBatchValues[batchIndex] > completedValue) {
+        batchIndex++;
+    }
+    if (batchIndex == UPLOAD_BATCHES_IN_FLIGHT) {
+        uploadStalls++;
+        return false;
+    }
+    VkCommandBuffer commandBuffer = uploadCommandBuffers[batchIndex];
+
+    VkCommandBufferBeginInfo beginInfo{};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkResetCommandBuffer(commandBuffer, 0);
+    vkBeginCommandBuffer(commandBuffer, &beginInfo);
+
+    RetiringStaging retiring{};
+    size_t batchChunks = 0;
+    while (!transferQueue.empty()) {
+        TransferInformation info = transferQueue.front();
+        if (slotGenerations[info.chunk_idx].load() != info.generation) {
+            //Superseded while it was uploading, nothing references its memory yet.
+            transferQueue.pop();
+            cancelledJobs++;
+            if (!info.inPlace && info.newChunk.rootNodeIndex != 0) {
+                octreeGPUManager.freeChunk(info.newChunk.rootNodeIndex);
             }
-            if (chunk.ChunkFarValuesOffset != 0) {
-                farValuesManager.freeChunk(chunk.ChunkFarValuesOffset);
+            if (!info.inPlace && info.newChunk.ChunkFarValuesOffset != 0) {
+                farValuesManager.freeChunk(info.newChunk.ChunkFarValuesOffset);
             }
+            if (info.octree_staging_offset != 0) stagingRing.freeChunk(info.octree_staging_offset);
+            if (info.far_values_staging_offset != 0) stagingRing.freeChunk(info.far_values_staging_offset);
+            stagingRing.freeChunk(info.staging_offset);
+            continue;
+        }
 
-            chunks[info.chunk_idx] = info.newChunk;
+        size_t uploadBytes = sizeof(Chunk);
+        if (!info.inPlace) {
+            uploadBytes += (info.newChunk.chunkSize + info.newChunk.offsetSize) * sizeof(uint32_t);
+        }
+        if (!uploadBudget.fits(uploadBytes)) {
+            //Keeps its staging memory until a later frame has room for it.
+            break;
+        }
+        if (!info.inPlace && !octreeGPUManager.isBound(info.newChunk.rootNodeIndex)) {
+            //Its chunk buffer gets bound at the start of the next frame.
+            break;
+        }
+        transferQueue.pop();
+        uploadBudget.consume(uploadBytes);
 
-            chunkDeleteQueue.push(info);
+        //Octree, far values and chunk table all go in this one submission.
+        if (info.far_values_staging_offset != 0) {
+            VkBufferCopy copyRegion{};
+            copyRegion.srcOffset = info.far_values_staging_offset;
+            copyRegion.dstOffset = info.newChunk.ChunkFarValuesOffset * sizeof(uint32_t);
+            copyRegion.size = info.newChunk.offsetSize * sizeof(uint32_t);
+            vkCmdCopyBuffer(commandBuffer, stagingBufferProperties.pStagingBuffer, farValuesManager.buffer, 1,
+                            &copyRegion);
+            retiring.stagingOffsets.push_back(info.far_values_staging_offset);
         }
-        vkEndCommandBuffer(stagingBufferProperties.transferCommandBuffer);
+        if (info.octree_staging_offset != 0) {
+            VkBufferCopy copyRegion{};
+            copyRegion.srcOffset = info.octree_staging_offset;
+            copyRegion.dstOffset = octreeGPUManager.localOffset(info.newChunk.rootNodeIndex) * sizeof(uint32_t);
+            copyRegion.size = info.newChunk.chunkSize * sizeof(uint32_t);
+            vkCmdCopyBuffer(commandBuffer, stagingBufferProperties.pStagingBuffer,
+                            octreeGPUManager.bufferFor(info.newChunk.rootNodeIndex), 1, &copyRegion);
+            retiring.stagingOffsets.push_back(info.octree_staging_offset);
+        }
+        VkBufferCopy copyRegion{};
+        copyRegion.srcOffset = info.staging_offset;
+        copyRegion.dstOffset = info.chunk_idx * sizeof(Chunk);
+        copyRegion.size = sizeof(Chunk);
+        vkCmdCopyBuffer(commandBuffer, stagingBufferProperties.pStagingBuffer, chunkBuffer, 1, &copyRegion);
+        retiring.stagingOffsets.push_back(info.staging_offset);
 
-        VkSubmitInfo submitInfo{};
-        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-        submitInfo.commandBufferCount = 1;
-        submitInfo.pCommandBuffers = &stagingBufferProperties.transferCommandBuffer;
-        submitInfo.signalSemaphoreCount = 1;
-        submitInfo.pSignalSemaphores = &stagingBufferProperties.transferSemaphore; {
-            std::lock_guard<std::mutex> queuelock(stagingBufferProperties.queueMut);
-            vkQueueSubmit(stagingBufferProperties.transferQueue, 1, &submitInfo, gridFence);
+        CpuChunk &chunk = slotChunk(info.chunk_idx);
+
+        //An in place LOD change keeps using the memory of the chunk it replaces.
+        if (chunk.rootNodeIndex != 0 && chunk.rootNodeIndex != info.newChunk.rootNodeIndex) {
+            octreeGPUManager.freeChunk(chunk.rootNodeIndex);
+        }
+        if (chunk.ChunkFarValuesOffset != 0 && chunk.ChunkFarValuesOffset != info.newChunk.ChunkFarValuesOffset) {
+            farValuesManager.freeChunk(chunk.ChunkFarValuesOffset);
         }
 
+        //Only grid chunks can be evicted, so the overview does not count against the budget
+        size_t &residentBytes = info.chunk_idx < chunks.size() ? gridResidentBytes : overviewResidentBytes;
+        residentBytes -= (static_cast<size_t>(chunk.chunkSize) + chunk.offsetSize) * sizeof(uint32_t);
+        residentBytes += (static_cast<size_t>(info.newChunk.chunkSize) + info.newChunk.offsetSize) * sizeof(uint32_t);
+        chunk = info.newChunk;
+        if (info.chunk_idx < chunks.size()) {
+            slotResidentSince[info.chunk_idx] = std::chrono::steady_clock::now();
+        }
+        markSlotChanged(info.chunk_idx);
+        batchChunks++;
+    }
+    uploadBudget.defer(transferQueue.size());
+    uint32_t movedChunks = compact ? compactPools(commandBuffer, retiring) : 0;
+    vkEndCommandBuffer(commandBuffer);
+    if (batchChunks == 0 && movedChunks == 0) {
+        return false;
+    }
+
+    //The binary semaphore lets this frame's compute pass wait for the copies, the timeline value tells us later
+    //when the staging memory can be reused.
+    uint64_t signalValue = ++uploadTimelineValue;
+    std::array<VkSemaphore, 2> signalSemaphores = {stagingBufferProperties.transferSemaphore, uploadTimeline};
+    std::array<uint64_t, 2> signalValues = {0, signalValue};
+    VkTimelineSemaphoreSubmitInfo timelineInfo{};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    timelineInfo.signalSemaphoreValueCount = static_cast<uint32_t>(signalValues.size());
+    timelineInfo.pSignalSemaphoreValues = signalValues.data();
 
-        return true;
+    VkSubmitInfo submitInfo{};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.pNext = &timelineInfo;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &commandBuffer;
+    submitInfo.signalSemaphoreCount = static_cast<uint32_t>(signalSemaphores.size());
+    submitInfo.pSignalSemaphores = signalSemaphores.data(); {
+        std::lock_guard<std::mutex> queuelock(stagingBufferProperties.queueMut);
+        vkQueueSubmit(stagingBufferProperties.transferQueue, 1, &submitInfo, VK_NULL_HANDLE);
     }
+    uploadBatchValues[batchIndex] = signalValue;
+    retiring.timelineValue = signalValue;
+    retiringStaging.push_back(std::move(retiring));
+    uploadBatches++;
+    uploadedChunks += batchChunks;
 
-    return false;
+    return true;
 }
 
 
+//Depth the shader stops at for the resolution the chunk is drawn at, see changeLODInPlace.
+inline uint32_t chunkMaxDepth(const CpuChunk &chunk) {
+    if (chunk.treeLevels == 0 || chunk.resolution >= chunk.treeResolution) {
+        return UINT32_MAX;
+    }
+    uint32_t droppedLevels = std::countr_zero(chunk.treeResolution) - std::countr_zero(chunk.resolution);
+    return chunk.treeLevels - 1 - droppedLevels;
+}
+
+bool DataManageThreat::compactionDue() {
+    if (config.compactionBytesPerFrame == 0 || std::chrono::steady_clock::now() < compactionIdleUntil) {
+        return false;
+    }
+    return octreeGPUManager.fragmentation() >= config.compactionThreshold ||
+           farValuesManager.fragmentation() >= config.compactionThreshold;
+}
+
+uint32_t DataManageThreat::compactPools(VkCommandBuffer commandBuffer, RetiringStaging &retiring) {
+    bool octreeFragmented = octreeGPUManager.fragmentation() >= config.compactionThreshold;
+    bool farValuesFragmented = farValuesManager.fragmentation() >= config.compactionThreshold;
+
+    //Slots still loading are left alone, their job or transfer may still point at the current memory. Moving the
+    //chunks at the end of the pool to the front first makes the free memory come together at the end.
+    std::vector<std::pair<uint32_t, uint32_t> > candidates;
+    for (uint32_t chunkIdx = 0; chunkIdx < slotTargets.size(); chunkIdx++) {
+        const CpuChunk &chunk = slotChunk(chunkIdx);
+        uint32_t offset = octreeFragmented ? chunk.rootNodeIndex : chunk.ChunkFarValuesOffset;
+        if (!chunk.loading && offset != 0) {
+            candidates.emplace_back(offset, chunkIdx);
+        }
+    }
+    std::sort(candidates.begin(), candidates.end(), std::greater<>());
+
+    size_t budget = config.compactionBytesPerFrame;
+    uint32_t moved = 0;
+    for (auto [_, chunkIdx]: candidates) {
+        CpuChunk &chunk = slotChunk(chunkIdx);
+        size_t octreeBytes = octreeFragmented ? chunk.chunkSize * sizeof(uint32_t) : 0;
+        size_t farValuesBytes = farValuesFragmented ? chunk.offsetSize * sizeof(uint32_t) : 0;
+        if (octreeBytes + farValuesBytes > budget) {
+            continue;
+        }
+        size_t newRoot = octreeBytes > 0
+                             ? octreeGPUManager.allocateChunkBelow(chunk.chunkSize, chunk.rootNodeIndex)
+                             : 0;
+        size_t newFarValues = farValuesBytes > 0
+                                  ? farValuesManager.allocateChunkBelow(chunk.offsetSize, chunk.ChunkFarValuesOffset)
+                                  : 0;
+        if (newRoot == 0 && newFarValues == 0) {
+            continue;
+        }
+        size_t tableIndex = stagingRing.allocateChunk(sizeof(Chunk), std::chrono::milliseconds(0));
+        if (tableIndex == 0) {
+            if (newRoot != 0) octreeGPUManager.freeChunk(newRoot);
+            if (newFarValues != 0) farValuesManager.freeChunk(newFarValues);
+            break;
+        }
+
+        if (moved == 0) {
+            //Earlier copies, of this batch or of batches before it, may have written what gets moved.
+            VkMemoryBarrier barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+            vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 1,
+                                 &barrier, 0, nullptr, 0, nullptr);
+        }
+        //The new location is free memory before the old one, so the two never overlap.
+        if (newRoot != 0) {
+            VkBufferCopy copyRegion{};
+            //The chunk can move to an earlier buffer, each allocation is within one buffer.
+            copyRegion.srcOffset = octreeGPUManager.localOffset(chunk.rootNodeIndex) * sizeof(uint32_t);
+            copyRegion.dstOffset = octreeGPUManager.localOffset(newRoot) * sizeof(uint32_t);
+            copyRegion.size = octreeBytes;
+            vkCmdCopyBuffer(commandBuffer, octreeGPUManager.bufferFor(chunk.rootNodeIndex),
+                            octreeGPUManager.bufferFor(newRoot), 1, &copyRegion);
+            retiring.octreeOffsets.push_back(chunk.rootNodeIndex);
+            chunk.rootNodeIndex = static_cast<uint32_t>(newRoot);
+            compactedBytes += octreeBytes;
+        }
+        if (newFarValues != 0) {
+            VkBufferCopy copyRegion{};
+            copyRegion.srcOffset = chunk.ChunkFarValuesOffset * sizeof(uint32_t);
+            copyRegion.dstOffset = newFarValues * sizeof(uint32_t);
+            copyRegion.size = farValuesBytes;
+            vkCmdCopyBuffer(commandBuffer, farValuesManager.buffer, farValuesManager.buffer, 1, &copyRegion);
+            retiring.farValuesOffsets.push_back(chunk.ChunkFarValuesOffset);
+            chunk.ChunkFarValuesOffset = static_cast<uint32_t>(newFarValues);
+            compactedBytes += farValuesBytes;
+        }
+
+        //The chunk table entry goes in the same submission, so the next frame sees the chunk at its new location.
+        auto chunkGpu = Chunk{
+            chunk.ChunkFarValuesOffset, octreeGPUManager.shaderRoot(chunk.rootNodeIndex), chunkMaxDepth(chunk),
+            chunk.colorsOffset, chunk.chunk_coords, octreeGPUManager.shaderBuffer(chunk.rootNodeIndex)
+        };
+        memcpy(static_cast<uint8_t *>(gpuDataPointer) + tableIndex, &chunkGpu, sizeof(Chunk));
+        VkBufferCopy copyRegion{};
+        copyRegion.srcOffset = tableIndex;
+        copyRegion.dstOffset = chunkIdx * sizeof(Chunk);
+        copyRegion.size = sizeof(Chunk);
+        vkCmdCopyBuffer(commandBuffer, stagingBufferProperties.pStagingBuffer, chunkBuffer, 1, &copyRegion);
+        retiring.stagingOffsets.push_back(tableIndex);
+
+        budget -= octreeBytes + farValuesBytes;
+        moved++;
+    }
+    if (moved == 0) {
+        compactionIdleUntil = std::chrono::steady_clock::now() + std::chrono::seconds(1);
+    }
+    compactedChunks += moved;
+    return moved;
+}
+
 void DataManageThreat::loadObj() {
     float _scale;
     int result = loadObject(objFile, objDirectory, config.chunk_resolution, config.grid_size, config.grid_height,
                             triangles, _scale);
 }
 
-void DataManageThreat::initFence() {
-    VkFenceCreateInfo fenceInfo{};
-    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-    fenceInfo.flags = 0;
-    vkCreateFence(device, &fenceInfo, nullptr, &transferFence);
-    // fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-    vkCreateFence(device, &fenceInfo, nullptr, &gridFence);
-}
-
-void DataManageThreat::initCommandBuffers() {
-    VkCommandPoolCreateInfo poolInfo{};
-    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
-    poolInfo.queueFamilyIndex = stagingBufferProperties.transferQueueIndex;
-    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-
-    vkCreateCommandPool(device, &poolInfo, nullptr, &threadCommandPool);
+void DataManageThreat::initUploadPipeline() {
+    VkSemaphoreTypeCreateInfo typeInfo{};
+    typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    typeInfo.initialValue = 0;
+
+    VkSemaphoreCreateInfo semaphoreInfo{};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphoreInfo.pNext = &typeInfo;
+    if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &uploadTimeline) != VK_SUCCESS) {
+        throw std::runtime_error("failed to create upload timeline semaphore!");
+    }
 
+    //Only the main thread records uploads, so these can come from the transfer pool of the application.
     VkCommandBufferAllocateInfo allocInfo{};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
     allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandPool = threadCommandPool;
-    allocInfo.commandBufferCount = 1;
-
-    // VkCommandBuffer commandBuffer;
-    vkAllocateCommandBuffers(device, &allocInfo, &threadCommandBuffer);
+    allocInfo.commandPool = stagingBufferProperties.transferCommandPool;
+    allocInfo.commandBufferCount = static_cast<uint32_t>(uploadCommandBuffers.size());
+    vkAllocateCommandBuffers(device, &allocInfo, uploadCommandBuffers.data());
 }
 
-void DataManageThreat::threadLoop() {
+
+void DataManageThreat::threadLoop(StreamingWorker &worker) {
+    std::vector<ChunkLoadInfo> jobs;
+    std::vector<ChunkReadCompletion> completions;
+    //Split the reads that can be in flight over the workers, so one worker does not take the whole queue.
+    size_t maxBatch = std::max<size_t>(chunkReader.capacity() / workers.size(), 1);
+    uint32_t maxPrefetches = std::max<uint32_t>(static_cast<uint32_t>(workers.size()) / 2, 1);
     while (true) {
-        ChunkLoadInfo job{}; {
+        std::optional<ChunkKey> prefetchKey;
+        jobs.clear(); {
             std::unique_lock<std::mutex> lock(queueMutex);
-            cv.wait(lock, [this] { return stopFlag || !workQueue.empty(); });
-
-            if (stopFlag && workQueue.empty())
+            cv.wait(lock, [this, maxPrefetches] {
+                return (stopFlag && pendingUploadCount.load() == 0) || !workQueue.empty() || !overviewQueue.empty() ||
+                       (!prefetchQueue.empty() && activePrefetches.load() < maxPrefetches) ||
+                       chunkReader.hasCompletions();
+            });
+
+            if (stopFlag && workQueue.empty() && pendingUploadCount.load() == 0) {
+                //The last reads may have been finished by this worker, the others are still waiting for them
+                cv.notify_all();
                 return; // exit thread
+            }
+
+            //Take as many jobs as we can keep reads in flight for, so the disk is never waiting on us.
+            while (!workQueue.empty() && jobs.size() < maxBatch &&
+                   pendingUploadCount.load() + jobs.size() < chunkReader.capacity()) {
+                std::pop_heap(workQueue.begin(), workQueue.end());
+                ChunkLoadInfo job = workQueue.back().job;
+                workQueue.pop_back();
+                if (!isCurrent(job)) {
+                    cancelledJobs++;
+                    continue;
+                }
+                jobs.push_back(job);
+            }
+
+            //The overview only fills in what the grid does not have yet, so it waits until the grid jobs are taken.
+            while (workQueue.empty() && !overviewQueue.empty() && jobs.size() < maxBatch &&
+                   pendingUploadCount.load() + jobs.size() < chunkReader.capacity()) {
+                ChunkLoadInfo job = overviewQueue.front();
+                overviewQueue.pop_front();
+                if (!isCurrent(job)) {
+                    cancelledJobs++;
+                    continue;
+                }
+                jobs.push_back(job);
+            }
 
-            job = workQueue.front();
-            workQueue.pop();
+            //Prefetching only uses idle workers, and never all of them so new jobs do not wait on a generation.
+            if (jobs.empty() && !prefetchQueue.empty() && activePrefetches.load() < maxPrefetches) {
+                prefetchKey = prefetchQueue.front();
+                prefetchQueue.pop_front();
+                activePrefetches++;
+            }
         }
 
         // Do the work outside the lock
-        loadChunkToGPU(job);
+        for (const auto &job: jobs) {
+            loadChunkToGPU(job, worker);
+        }
+        if (prefetchKey) {
+            prefetchChunk(*prefetchKey, worker);
+            activePrefetches--;
+        }
+
+        //Upload whatever reads finished, in the order the disk completed them. Any worker can finish any read.
+        completions.clear();
+        chunkReader.pollCompletions(completions);
+        for (const auto &completion: completions) {
+            PendingChunkUpload upload; {
+                std::lock_guard<std::mutex> lock(uploadsMutex);
+                auto it = pendingUploads.find(completion.userData);
+                upload = std::move(it->second);
+                pendingUploads.erase(it);
+                pendingUploadCount--;
+            }
+            if (!isCurrent(upload.job)) {
+                //Superseded while reading, skip the transfer
+                cancelledJobs++;
+                releaseChunkUpload(upload);
+            } else if (completion.success) {
+                //The staging memory is only ours until the upload is submitted
+                ChunkKey key{upload.job.chunkCoord, upload.job.resolution};
+                if (chunkCache.enabled() && !chunkCache.contains(key)) {
+                    chunkCache.put(key, copyFromStaging(upload));
+                }
+                submitChunkUpload(upload);
+            } else {
+                spdlog::error("Failed to read chunk {}, {}, {} from disk!", upload.job.chunkCoord.x,
+                              upload.job.chunkCoord.y, upload.job.chunkCoord.z);
+                releaseChunkUpload(upload);
+            }
+        }
     }
 }
 
-void DataManageThreat::loadChunkToGPU(ChunkLoadInfo job) {
+void DataManageThreat::reportFailedAllocation(const PendingChunkUpload &upload) {
+    //The overview is coarse already, only the grid makes room.
+    if (upload.chunkIdx < chunks.size()) {
+        residency.allocationFailed(upload.chunkIdx, upload.job.chunkCoord, upload.job.resolution,
+                                   (upload.octreeElements + upload.farValuesElements) * sizeof(uint32_t));
+    }
+}
+
+void DataManageThreat::releaseSlot(uint32_t chunkIdx, uint32_t generation) {
+    std::lock_guard<std::mutex> lock(transferQueueMutex);
+    releasedSlots.emplace_back(chunkIdx, generation);
+}
+
+void DataManageThreat::loadChunkToGPU(ChunkLoadInfo job, StreamingWorker &worker) {
     if (config.printChunkDebug) {
         spdlog::debug("Chunk Coords to load: {}, {}, {}, Desired resolution: {}", job.chunkCoord.x,
                       job.chunkCoord.y, job.chunkCoord.z,
                       job.resolution);
     }
-    uint32_t chunkIdx = job.gridCoord.z * config.grid_size * config.grid_size
-                        + job.gridCoord.y * config.grid_size
-                        + job.gridCoord.x;
+    PendingChunkUpload upload{};
+    upload.job = job;
+    upload.chunkIdx = slotIndex(job);
     //Load stuff to be copied onto the GPU
-    if (!checkChunkResolution(job)) {
-        //Chunk is not in the right resolution for the camera position, cancel
-        chunks[chunkIdx].loading = false;
+    if (!isCurrent(job)) {
+        //The slot got a new target while this job was waiting, cancel
+        cancelledJobs++;
         return;
     }
     // std::this_thread::sleep_for(std::chrono::seconds(5));
-    auto chunkOctreeGPU = std::vector<uint32_t>();
-    auto chunkFarValues = std::vector<uint32_t>();
-    loadChunkData(job, chunkFarValues, chunkOctreeGPU);
-    uint32_t rootNodeIndex = 0;
-    uint32_t farValuesOffset = 0;
-    if (!chunkOctreeGPU.empty()) {
-        rootNodeIndex = octreeGPUManager.allocateChunk(chunkOctreeGPU.size());
-        if (rootNodeIndex == 0) {
-            std::cerr << "Octree GPU Buffer has no memory to be allocated!" << std::endl;
-            chunks[chunkIdx].loading = false;
+    //Recently used chunks are still in memory, no need to touch the disk or generate them.
+    ChunkKey key{job.chunkCoord, job.resolution};
+    if (auto cached = chunkCache.get(key)) {
+        {
+            std::lock_guard<std::mutex> lock(prefetchMutex);
+            prefetchHits += prefetchedKeys.erase(key);
+        }
+        setUploadSizes(upload, *cached);
+        if (!allocateChunkUpload(upload)) {
             return;
         }
+        copyToStaging(upload, *cached);
+        submitChunkUpload(upload);
+        return;
     }
-    if (!chunkFarValues.empty()) {
-        farValuesOffset = farValuesManager.allocateChunk(chunkFarValues.size());
-        if (farValuesOffset == 0) {
-            spdlog::error("Far Values Buffer has no memory to be allocated!");
-            chunks[chunkIdx].loading = false;;
+
+    //If the chunk is on disk we only read the header here, the payload gets read by the async reader straight into
+    //the staging buffer. The cache gets a copy of it once the read completed.
+    upload.file = std::make_unique<ChunkFile>();
+    if (openChunk(directory, config.chunk_resolution, job.resolution, job.chunkCoord, *upload.file)) {
+        uint64_t uploadId = nextUploadId++;
+        //The node colors go right after the nodes, like for generated chunks
+        upload.octreeElements = upload.file->gpuDataSize + upload.file->nodeColorsSize;
+        upload.farValuesElements = upload.file->farValuesSize;
+        upload.treeLevels = upload.file->nodeColorsSize == 0 ? 0 : upload.file->treeLevels;
+        upload.colorsOffset = upload.file->gpuDataSize;
+        if (!allocateChunkUpload(upload)) {
             return;
         }
+        auto *dst = static_cast<uint8_t *>(gpuDataPointer);
+        ChunkReadRequest request{
+            upload.file.get(), dst + upload.octreeIndex, dst + upload.farValueIndex,
+            dst + upload.octreeIndex + upload.file->gpuDataSize * sizeof(uint32_t), uploadId
+        };
+        {
+            std::lock_guard<std::mutex> lock(uploadsMutex);
+            pendingUploads.emplace(uploadId, std::move(upload));
+            pendingUploadCount++;
+        }
+        chunkReader.submit(request);
+        return;
     }
-    auto chunkGpu = Chunk{farValuesOffset, rootNodeIndex};
+    upload.file.reset();
 
-    VkDeviceSize farValuesSize = chunkFarValues.size() * sizeof(uint32_t);
-    VkDeviceSize octreeSize = chunkOctreeGPU.size() * sizeof(uint32_t);
-    VkDeviceSize chunkSize = sizeof(Chunk);
+    auto data = std::make_shared<ChunkData>();
+    data->nodeCount = generateChunkData(job, data->farValues, data->gpuData, worker);
+    data->computeNodeColors();
+    setUploadSizes(upload, *data);
+    if (!allocateChunkUpload(upload)) {
+        return;
+    }
+    copyToStaging(upload, *data);
+    submitChunkUpload(upload);
+    chunkCache.put(key, data);
+    //Storing the chunk on disk happens in the background, the upload does not have to wait for it.
+    chunkWriter->enqueue(job.resolution, job.chunkCoord, std::move(data));
+}
+
+void DataManageThreat::prefetchChunk(const ChunkKey &key, StreamingWorker &worker) {
+    if (chunkCache.contains(key)) {
+        return;
+    }
+    auto data = std::make_shared<ChunkData>();
+    if (loadChunk(directory, config.chunk_resolution, key.resolution, key.chunkCoord, data->nodeCount, data->gpuData,
+                  data->farValues, data->nodeColors, data->treeLevels)) {
+        //Files from before the node colors were stored
+        if (data->nodeColors.empty()) {
+            data->computeNodeColors();
+        }
+        chunkCache.put(key, data);
+    } else {
+        ChunkLoadInfo job{glm::ivec3(0), key.resolution, key.chunkCoord};
+        data->nodeCount = generateChunkData(job, data->farValues, data->gpuData, worker);
+        data->computeNodeColors();
+        chunkCache.put(key, data);
+        chunkWriter->enqueue(key.resolution, key.chunkCoord, std::move(data));
+    } {
+        std::lock_guard<std::mutex> lock(prefetchMutex);
+        prefetchedKeys.insert(key);
+    }
+    prefetchedChunks++;
+}
+
+void DataManageThreat::copyToStaging(const PendingChunkUpload &upload, const ChunkData &data) {
+    auto *dst = static_cast<uint8_t *>(gpuDataPointer);
+    if (!data.farValues.empty()) {
+        memcpy(dst + upload.farValueIndex, data.farValues.data(), data.farValues.size() * sizeof(uint32_t));
+    }
+    if (!data.gpuData.empty()) {
+        memcpy(dst + upload.octreeIndex, data.gpuData.data(), data.gpuData.size() * sizeof(uint32_t));
+    }
+    if (!data.nodeColors.empty()) {
+        memcpy(dst + upload.octreeIndex + data.gpuData.size() * sizeof(uint32_t), data.nodeColors.data(),
+               data.nodeColors.size() * sizeof(uint32_t));
+    }
+}
+
+std::shared_ptr<ChunkData> DataManageThreat::copyFromStaging(const PendingChunkUpload &upload) {
+    auto *src = static_cast<const uint8_t *>(gpuDataPointer);
+    auto data = std::make_shared<ChunkData>();
+    data->nodeCount = upload.file->nodeCount;
+    data->gpuData.resize(upload.file->gpuDataSize);
+    data->farValues.resize(upload.file->farValuesSize);
+    data->nodeColors.resize(upload.file->nodeColorsSize);
+    data->treeLevels = upload.treeLevels;
+    if (!data->gpuData.empty()) {
+        memcpy(data->gpuData.data(), src + upload.octreeIndex, data->gpuData.size() * sizeof(uint32_t));
+    }
+    if (!data->farValues.empty()) {
+        memcpy(data->farValues.data(), src + upload.farValueIndex, data->farValues.size() * sizeof(uint32_t));
+    }
+    if (!data->nodeColors.empty()) {
+        memcpy(data->nodeColors.data(), src + upload.octreeIndex + data->gpuData.size() * sizeof(uint32_t),
+               data->nodeColors.size() * sizeof(uint32_t));
+    } else {
+        //Files from before the node colors were stored
+        data->computeNodeColors();
+    }
+    return data;
+}
+
+void DataManageThreat::setUploadSizes(PendingChunkUpload &upload, const ChunkData &data) {
+    upload.octreeElements = data.gpuData.size() + data.nodeColors.size();
+    upload.farValuesElements = data.farValues.size();
+    upload.treeLevels = data.nodeColors.empty() ? 0 : data.treeLevels;
+    upload.colorsOffset = static_cast<uint32_t>(data.gpuData.size());
+}
+
+bool DataManageThreat::allocateChunkUpload(PendingChunkUpload &upload) {
+    if (upload.octreeElements > 0) {
+        upload.rootNodeIndex = octreeGPUManager.allocateChunk(upload.octreeElements);
+        if (upload.rootNodeIndex == 0) {
+            //A new buffer is on its way otherwise, the job gets queued again next frame.
+            if (!octreeGPUManager.growthRequested()) {
+                std::cerr << "Octree GPU Buffer has no memory to be allocated!" << std::endl;
+                reportFailedAllocation(upload);
+            }
+            releaseSlot(upload.chunkIdx, upload.job.generation);
+            return false;
+        }
+    }
+    if (upload.farValuesElements > 0) {
+        upload.farValuesOffset = farValuesManager.allocateChunk(upload.farValuesElements);
+        if (upload.farValuesOffset == 0) {
+            spdlog::error("Far Values Buffer has no memory to be allocated!");
+            reportFailedAllocation(upload);
+            releaseChunkUpload(upload);
+            return false;
+        }
+    }
+
+    VkDeviceSize farValuesSize = upload.farValuesElements * sizeof(uint32_t);
+    VkDeviceSize octreeSize = upload.octreeElements * sizeof(uint32_t);
     //Copy the chunk Values into the staging buffer
-    VkDeviceSize totalSize = farValuesSize + octreeSize + chunkSize;
+    VkDeviceSize totalSize = farValuesSize + octreeSize + sizeof(Chunk);
 
     if (totalSize > stagingBufferProperties.bufferSize) {
         std::cerr << "Chunk values are bigger than staging buffer!" << std::endl;
-        return;
+        releaseChunkUpload(upload);
+        return false;
     }
 
-    auto *dst = static_cast<uint8_t *>(gpuDataPointer);
-    VkCommandBufferBeginInfo beginInfo{};
-    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
-    vkResetCommandBuffer(threadCommandBuffer, 0);
-    vkBeginCommandBuffer(threadCommandBuffer, &beginInfo);
-    size_t farValueIndex = 0;
-    size_t octreeIndex = 0;
     if (farValuesSize > 0) {
-        farValueIndex = stagingBufferManager.allocateChunk(farValuesSize);
-        if (farValueIndex == 0) {
+        upload.farValueIndex = stagingRing.allocateChunk(farValuesSize);
+        if (upload.farValueIndex == 0) {
             spdlog::error("Ran out of memory in the staging buffer while copying farvalues!");
-            chunks[chunkIdx].loading = false;
-            return;
+            releaseChunkUpload(upload);
+            return false;
         }
-        memcpy(dst + farValueIndex, chunkFarValues.data(), farValuesSize);
-
-        VkBufferCopy copyRegion{};
-        copyRegion.srcOffset = farValueIndex;
-        copyRegion.dstOffset = farValuesOffset * sizeof(uint32_t);
-        copyRegion.size = farValuesSize;
-        vkCmdCopyBuffer(threadCommandBuffer, stagingBufferProperties.pStagingBuffer, farValuesManager.buffer, 1,
-                        &copyRegion);
     }
 
     if (octreeSize > 0) {
-        octreeIndex = stagingBufferManager.allocateChunk(octreeSize);
-        if (octreeIndex == 0) {
+        upload.octreeIndex = stagingRing.allocateChunk(octreeSize);
+        if (upload.octreeIndex == 0) {
             spdlog::error("Ran out of memory in the staging buffer while copying octree!");
-            stagingBufferManager.freeChunk(farValueIndex);
-            chunks[chunkIdx].loading = false;
-            return;
+            releaseChunkUpload(upload);
+            return false;
         }
-        memcpy(dst + octreeIndex, chunkOctreeGPU.data(), octreeSize);
-        VkBufferCopy copyRegion{};
-        copyRegion.srcOffset = octreeIndex;
-        copyRegion.dstOffset = rootNodeIndex * sizeof(uint32_t);
-        copyRegion.size = octreeSize;
-        vkCmdCopyBuffer(threadCommandBuffer, stagingBufferProperties.pStagingBuffer, octreeGPUManager.buffer, 1,
-                        &copyRegion);
     }
+    return true;
+}
+
+void DataManageThreat::releaseChunkUpload(PendingChunkUpload &upload) {
+    if (upload.octreeIndex != 0) stagingRing.freeChunk(upload.octreeIndex);
+    if (upload.farValueIndex != 0) stagingRing.freeChunk(upload.farValueIndex);
+    if (upload.rootNodeIndex != 0) octreeGPUManager.freeChunk(upload.rootNodeIndex);
+    if (upload.farValuesOffset != 0) farValuesManager.freeChunk(upload.farValuesOffset);
+    upload.octreeIndex = upload.farValueIndex = 0;
+    upload.rootNodeIndex = upload.farValuesOffset = 0;
+    releaseSlot(upload.chunkIdx, upload.job.generation);
+}
+
+void DataManageThreat::submitChunkUpload(PendingChunkUpload &upload) {
+    //The payload is in the staging buffer, the file is not needed anymore.
+    upload.file.reset();
+    auto chunkGpu = Chunk{
+        upload.farValuesOffset, octreeGPUManager.shaderRoot(upload.rootNodeIndex), UINT32_MAX, upload.colorsOffset,
+        upload.job.chunkCoord, octreeGPUManager.shaderBuffer(upload.rootNodeIndex)
+    };
+    VkDeviceSize chunkSize = sizeof(Chunk);
 
     //There is always chunk information, so we will always copy that over.
-    auto chunkIndex = stagingBufferManager.allocateChunk(chunkSize);
+    auto chunkIndex = stagingRing.allocateChunk(chunkSize);
     if (chunkIndex == 0) {
         spdlog::error("Ran out of memory in the staging buffer while copying chunk info!");
-        stagingBufferManager.freeChunk(farValueIndex);
-        stagingBufferManager.freeChunk(octreeIndex);
-        chunks[chunkIdx].loading = false;
+        releaseChunkUpload(upload);
         return;
     }
+    auto *dst = static_cast<uint8_t *>(gpuDataPointer);
     memcpy(dst + chunkIndex, &chunkGpu, chunkSize);
 
-
-    vkEndCommandBuffer(threadCommandBuffer);
-
-    VkSubmitInfo submitInfo{};
-    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &threadCommandBuffer; {
-        std::lock_guard<std::mutex> queuelock(stagingBufferProperties.queueMut);
-        vkQueueSubmit(stagingBufferProperties.transferQueue, 1, &submitInfo, transferFence);
+    if (upload.job.offscreenLevels > 0) {
+        //Every level has about four times the nodes of the one above it, like for the in place LOD changes.
+        size_t bytes = (upload.octreeElements + upload.farValuesElements) * sizeof(uint32_t);
+        offscreenUploads++;
+        offscreenBytesSaved += bytes * ((static_cast<size_t>(1) << (2 * upload.job.offscreenLevels)) - 1);
     }
-    //Wait for the octree copy to be done before we start copying grid values over.
-    vkWaitForFences(device, 1, &transferFence, VK_TRUE, UINT64_MAX);
-    vkResetFences(device, 1, &transferFence);
 
-    //Octree and Farvalues are now on the GPU, can be freed again on the staging buffer.
-    if (octreeIndex != 0) {
-        stagingBufferManager.freeChunk(octreeIndex);
-    }
-    if (farValueIndex != 0) {
-        stagingBufferManager.freeChunk(farValueIndex);
-    }
-
-    //Once we are done transferring the chunk and far values, notify the main thread that it can queue the chunk transfer
+    //The main thread records the copies of every ready chunk into one submission, the staging memory is freed once
+    //the GPU is done with it.
     {
         std::lock_guard<std::mutex> lock(transferQueueMutex);
-        uint32_t chunk_idx = (job.gridCoord.z * config.grid_size * config.grid_size) +
-                             job.gridCoord.y * config.grid_size
-                             + job.gridCoord.x;
-        CpuChunk newChunk = CpuChunk(farValuesOffset, rootNodeIndex, job.resolution, job.chunkCoord);
-        newChunk.chunkSize = chunkOctreeGPU.size();
-        newChunk.offsetSize = chunkFarValues.size();
-        transferQueue.push({chunk_idx, chunkIndex, newChunk});
+        CpuChunk newChunk = CpuChunk(upload.farValuesOffset, upload.rootNodeIndex, upload.job.resolution,
+                                     upload.job.chunkCoord);
+        newChunk.chunkSize = upload.octreeElements;
+        newChunk.offsetSize = upload.farValuesElements;
+        newChunk.treeLevels = upload.treeLevels;
+        newChunk.treeResolution = upload.job.resolution;
+        newChunk.colorsOffset = upload.colorsOffset;
+        transferQueue.push({
+            upload.chunkIdx, upload.job.generation, chunkIndex, upload.octreeIndex, upload.farValueIndex, newChunk
+        });
     }
 }
 
 
-bool DataManageThreat::checkChunkResolution(const ChunkLoadInfo &job) {
-    auto cameraChunkCoords = camera.chunk_coords;
-    glm::ivec3 diff = job.chunkCoord - cameraChunkCoords;
-    glm::vec3 worldDiff = glm::vec3(diff) * (static_cast<float>(config.chunk_resolution) * config.voxelscale);
-    float distance = glm::length(worldDiff) - (static_cast<float>(config.chunk_resolution) * config.voxelscale);
-    uint32_t octreeResolution = calculateChunkResolution(config.chunk_resolution, distance / config.scaleDistance);
-
-    return octreeResolution == job.resolution;
+void DataManageThreat::printStats() {
+    size_t queued; {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        queued = workQueue.size();
+    }
+    spdlog::info("Streaming queue: {} jobs queued, {} cancelled", queued, cancelledJobs.load());
+    spdlog::info("Uploads: {} chunks in {} batches, {} frames waiting on a free batch, {} batches retiring",
+                 uploadedChunks.load(), uploadBatches.load(), uploadStalls.load(), retiringStaging.size());
+    spdlog::info("LOD changes without uploading the chunk: {}, about {:.2f} MB not uploaded", inPlaceLODChanges,
+                 static_cast<double>(inPlaceBytesSaved) / (1024.0 * 1024.0));
+    spdlog::info("Compaction: {} chunks moved, {:.2f} MB", compactedChunks, bytesToMB(compactedBytes));
+    if (config.offscreenLodLevels > 0) {
+        spdlog::info("Outside the view: {} chunks loaded coarser, about {:.2f} MB not uploaded or resident",
+                     offscreenUploads.load(), bytesToMB(offscreenBytesSaved.load()));
+    }
+    uploadBudget.printStats();
+    residency.printStats(gridResidentBytes);
+    if (config.overviewSize > 0) {
+        spdlog::info("Overview: {:.2f} MB resident, outside the GPU budget", bytesToMB(overviewResidentBytes));
+    }
+    if (config.traversalFeedback) {
+        traversalFeedback.printStats();
+    }
+    chunkReader.printStats();
+    chunkWriter->printStats();
+    chunkCache.printStats();
+
+    if (config.prefetchSeconds > 0.0f && chunkCache.enabled()) {
+        size_t waiting, unused; {
+            std::lock_guard<std::mutex> lock(queueMutex);
+            waiting = prefetchQueue.size();
+        } {
+            //Prefetched chunks that got evicted before anything asked for them were wasted work.
+            std::lock_guard<std::mutex> lock(prefetchMutex);
+            prefetchesEvicted += std::erase_if(prefetchedKeys, [this](const ChunkKey &key) {
+                return !chunkCache.contains(key);
+            });
+            unused = prefetchedKeys.size();
+        }
+        uint64_t prefetched = prefetchedChunks.load();
+        uint64_t used = prefetchHits.load();
+        spdlog::info("Prefetch: {} queued, {} prefetched, {} used ({:.1f}% hit rate), {} not used yet, {} evicted unused",
+                     waiting, prefetched, used,
+                     prefetched == 0 ? 0.0 : static_cast<double>(used) / static_cast<double>(prefetched) * 100.0,
+                     unused, prefetchesEvicted);
+    }
+    auto minuteAgo = std::chrono::steady_clock::now() - std::chrono::minutes(1);
+    while (!lodChanges.empty() && lodChanges.front() < minuteAgo) lodChanges.pop_front();
+    while (!lodFlips.empty() && lodFlips.front() < minuteAgo) lodFlips.pop_front();
+    spdlog::info("LOD changes in the last minute: {}, of which {} flipped back", lodChanges.size(), lodFlips.size());
+    if (!overviewChunks.empty()) {
+        size_t loaded = 0;
+        size_t overviewBytes = 0;
+        for (size_t i = 0; i < overviewChunks.size(); i++) {
+            const CpuChunk &chunk = overviewChunks[i];
+            loaded += slotTargets[chunks.size() + i] == ChunkKey{chunk.chunk_coords, chunk.resolution};
+            overviewBytes += (static_cast<size_t>(chunk.chunkSize) + chunk.offsetSize) * sizeof(uint32_t);
+        }
+        spdlog::info("Overview: {}/{} chunks loaded, {:.2f} MB", loaded, overviewChunks.size(),
+                     bytesToMB(overviewBytes));
+    }
+    spdlog::info("Frames with non-resident chunks: {}/{} ({:.1f}%)", framesMissingChunks, frames,
+                 frames == 0 ? 0.0 : static_cast<double>(framesMissingChunks) / static_cast<double>(frames) * 100.0);
 }
 
 inline bool sceneInChunk(const Aabb &scene, const Aabb &chunk, const float &scale) {
@@ -455,117 +1297,152 @@ inline bool sceneInChunk(const Aabb &scene, const Aabb &chunk, const float &scal
     );
 }
 
-void DataManageThreat::loadChunkData(ChunkLoadInfo &job, std::vector<uint32_t> &chunkFarValues,
-                                     std::vector<uint32_t> &chunkOctreeGPU) {
+uint32_t DataManageThreat::generateChunkData(ChunkLoadInfo &job, std::vector<uint32_t> &chunkFarValues,
+                                             std::vector<uint32_t> &chunkOctreeGPU, StreamingWorker &worker) {
     uint32_t nodeAmount = 0;
-    if (!loadChunk(directory, config.chunk_resolution, job.resolution, job.chunkCoord, nodeAmount, chunkOctreeGPU,
-                   chunkFarValues)) {
-        if (!config.useHeightmapData && !sceneLoaded) {
+    if (!config.useHeightmapData) {
+        //The first worker to need the scene loads it, the others wait for it.
+        std::lock_guard<std::mutex> lock(sceneMutex);
+        if (!sceneLoaded) {
             spdlog::debug("Loading scene");
             loadObj();
             sceneLoaded = true;
             spdlog::debug("Finished loading scene");
         }
-        // spdlog::debug("Chunk not yet created, generating the chunk");
-        auto aabb = Aabb{};
-        aabb.aa = glm::ivec3(job.chunkCoord.x * config.chunk_resolution, job.chunkCoord.y * config.chunk_resolution,
-                             job.chunkCoord.z * config.chunk_resolution);
-        aabb.bb = glm::ivec3(aabb.aa.x + config.chunk_resolution, aabb.aa.y + config.chunk_resolution,
-                             aabb.aa.z + config.chunk_resolution);
-        uint32_t maxDepth = std::ceil(std::log2(job.resolution));
-
-
-        std::optional<OctreeNode> node = std::nullopt;
-        if (config.useHeightmapData) {
-            // uint32_t scale = config.chunk_resolution / job.resolution;
-            node = createChunkOctree(job.resolution, config.seed, job.chunkCoord, config.chunk_resolution,
-                                     config.voxelscale,
-                                     config.grid_height, nodeAmount);
-        } else if (sceneInChunk(objSceneData->sceneAabb, aabb, objSceneData->scale)) {
-            std::vector<uint32_t> allIndices(triangles.size());
-            std::iota(allIndices.begin(), allIndices.end(), 0);
-            node = createNode(aabb, triangles, allIndices, textures, nodeAmount, maxDepth, 0, objSceneData.value());
-        }
-
-
-        if (node) {
-            auto shared_node = std::make_shared<OctreeNode>(*node);
-            addOctreeGPUdata(chunkOctreeGPU, shared_node, nodeAmount, chunkFarValues);
-            if (!saveChunk(directory, config.chunk_resolution, job.resolution, job.chunkCoord, nodeAmount,
-                           chunkOctreeGPU, chunkFarValues)) {
-                std::cout << "Something went wrong storing Chunk data" << std::endl;
-            }
-        } else {
-            saveChunk(directory, config.chunk_resolution, job.resolution, job.chunkCoord, nodeAmount,
-                      chunkOctreeGPU, chunkFarValues);
-        }
     }
-}
+    // spdlog::debug("Chunk not yet created, generating the chunk");
+    auto aabb = Aabb{};
+    aabb.aa = glm::ivec3(job.chunkCoord.x * config.chunk_resolution, job.chunkCoord.y * config.chunk_resolution,
+                         job.chunkCoord.z * config.chunk_resolution);
+    aabb.bb = glm::ivec3(aabb.aa.x + config.chunk_resolution, aabb.aa.y + config.chunk_resolution,
+                         aabb.aa.z + config.chunk_resolution);
+    uint32_t maxDepth = std::ceil(std::log2(job.resolution));
+
+
+    std::optional<OctreeNode> node = std::nullopt;
+    if (config.useHeightmapData) {
+        // uint32_t scale = config.chunk_resolution / job.resolution;
+        node = createChunkOctree(job.resolution, config.seed, job.chunkCoord, config.chunk_resolution,
+                                 config.voxelscale,
+                                 config.grid_height, nodeAmount);
+    } else if (sceneInChunk(objSceneData->sceneAabb, aabb, objSceneData->scale)) {
+        std::vector<uint32_t> allIndices(triangles.size());
+        std::iota(allIndices.begin(), allIndices.end(), 0);
+        node = createNode(aabb, triangles, allIndices, worker.textures, nodeAmount, maxDepth, 0, objSceneData.value());
+    }
 
-inline int positive_mod(int a, int b) {
-    return (a % b + b) % b;
+
+    if (node) {
+        auto shared_node = std::make_shared<OctreeNode>(*node);
+        //Breadth first like chunkgen, so the chunk can be drawn at lower resolutions without uploading it again.
+        addOctreeGPUdataBF(chunkOctreeGPU, shared_node, nodeAmount, chunkFarValues);
+    }
+    return nodeAmount;
 }
 
 
-void checkChunks(std::vector<CpuChunk> &chunks, CPUCamera &camera, uint32_t maxChunkResolution, float voxelScale, float scaleDistance,
-                 DataManageThreat &dmThreat) {
+void checkChunks(std::vector<CpuChunk> &chunks, CPUCamera &camera, DataManageThreat &dmThreat) {
     auto center = camera.gpu_camera.camera_grid_pos;
-    auto processOffset = [&](int dx, int dy, int dz) {
-        if ((center.z + dz) < 0 || (center.z + dz) >= static_cast<int>(camera.gridHeight)) {
+    dmThreat.rescoreWork();
+    dmThreat.updateOverview();
+    dmThreat.relieveMemoryPressure();
+    const LodShellTable &shellTable = dmThreat.lodShells();
+    ViewCone viewCone = dmThreat.viewCone();
+    uint32_t offscreenLevels = dmThreat.offscreenLodLevels();
+    auto processCell = [&](const LodShellCell &cell) {
+        glm::ivec3 offset = cell.offset;
+        if ((center.z + offset.z) < 0 || (center.z + offset.z) >= static_cast<int>(camera.gridHeight)) {
             return;
         }
 
         auto gridCoord = glm::ivec3{
-            positive_mod(center.x + dx, static_cast<int>(camera.gridSize)),
-            positive_mod(center.y + dy, static_cast<int>(camera.gridSize)),
-            center.z + dz
+            positive_mod(center.x + offset.x, static_cast<int>(camera.gridSize)),
+            positive_mod(center.y + offset.y, static_cast<int>(camera.gridSize)),
+            center.z + offset.z
         };
 
         auto chunkCoord = glm::ivec3{
-            camera.chunk_coords.x + dx,
-            camera.chunk_coords.y + dy,
-            center.z + dz
+            camera.chunk_coords.x + offset.x,
+            camera.chunk_coords.y + offset.y,
+            center.z + offset.z
         };
 
-        auto dist = glm::ivec3(abs(dx), abs(dy), abs(dz));
-        glm::vec3 worldDiff = glm::vec3(dist) * (static_cast<float>(maxChunkResolution) * voxelScale);
-        float distance = glm::length(worldDiff) - (static_cast<float>(maxChunkResolution) * voxelScale);;
-        uint32_t octreeResolution = calculateChunkResolution(maxChunkResolution, distance / scaleDistance);
+        uint32_t octreeResolution = cell.resolution;
+        uint32_t coarsest = cell.coarsest;
+        uint32_t coarsenedLevels = 0;
+        bool outsideView = offscreenLevels > 0 && !viewCone.contains(offset);
+        if (outsideView) {
+            //Finer chunks that are already loaded may stay, looking away should not cause any uploads.
+            octreeResolution = std::max(octreeResolution >> offscreenLevels, MIN_CHUNK_RESOLUTION);
+            coarsest = std::max(coarsest >> offscreenLevels, MIN_CHUNK_RESOLUTION);
+            coarsenedLevels = std::countr_zero(cell.resolution) - std::countr_zero(octreeResolution);
+        }
+        uint32_t chunkIdx = gridCoord.z * camera.gridSize * camera.gridSize + gridCoord.y * camera.gridSize +
+                            gridCoord.x;
+        CpuChunk &chunk = chunks[chunkIdx];
+        //What the rays needed is only known for the chunk the slot already holds
+        uint32_t needed = chunk.chunk_coords == chunkCoord ? dmThreat.feedbackResolution(chunkIdx) : UINT32_MAX;
+        if (offscreenLevels > 0 && needed != UINT32_MAX) {
+            //Rays that hit voxels smaller than a pixel get by with fewer levels, no ray entering means it is hidden.
+            uint32_t lowest = std::max(cell.resolution >> offscreenLevels, MIN_CHUNK_RESOLUTION);
+            uint32_t fromRays = std::clamp(needed, lowest, cell.resolution);
+            if (fromRays < octreeResolution) {
+                octreeResolution = fromRays;
+                coarsest = std::min(coarsest, fromRays);
+                coarsenedLevels = std::countr_zero(cell.resolution) - std::countr_zero(octreeResolution);
+            }
+            outsideView |= needed == 0;
+        }
 
-        CpuChunk &chunk = chunks[gridCoord.z * camera.gridSize * camera.gridSize +
-                                 gridCoord.y * camera.gridSize
-                                 + gridCoord.x];
-        if (!chunk.loading && (chunk.chunk_coords != chunkCoord || chunk.resolution != octreeResolution)) {
-            dmThreat.pushWork(ChunkLoadInfo{gridCoord, octreeResolution, chunkCoord});
+        if (chunk.chunk_coords == chunkCoord && chunk.resolution != 0 && chunk.resolution != octreeResolution) {
+            //Keep the loaded resolution while it is close enough, and do not swap out a chunk that only just arrived.
+            if (chunk.resolution >= coarsest && chunk.resolution <= cell.finest) {
+                octreeResolution = chunk.resolution;
+            } else if (!dmThreat.lodChangeAllowed(chunkIdx)) {
+                octreeResolution = chunk.resolution;
+                dmThreat.recheckWhenLodChangeAllowed(chunkIdx);
+            }
+        }
+        //Evicted for lack of GPU memory, it comes back coarser or not at all until there is room again. A coarser load
+        //has to wait for the eviction, or it would need its memory while the old chunk still holds on to it.
+        if (dmThreat.evictionPending(chunkIdx)) {
+            dmThreat.setSlotMissing(chunkIdx, true);
+            return;
+        }
+        octreeResolution = dmThreat.residencyCap(chunkIdx, chunkCoord, octreeResolution);
+        if (octreeResolution == 0) {
+            dmThreat.setSlotMissing(chunkIdx, true);
+            dmThreat.keepEmpty(chunkIdx, chunkCoord, chunk);
+            return;
+        }
+        dmThreat.setSlotMissing(chunkIdx, chunk.chunk_coords != chunkCoord || chunk.resolution == 0);
+        if (chunk.chunk_coords != chunkCoord || chunk.resolution != octreeResolution) {
+            //Also retargets slots that are still loading a chunk the camera has moved away from.
+            ChunkLoadInfo job{gridCoord, octreeResolution, chunkCoord};
+            job.outsideView = outsideView;
+            job.offscreenLevels = octreeResolution < cell.resolution ? coarsenedLevels : 0;
+            dmThreat.pushWork(job, chunk);
             chunk.loading = true;
+        } else if (chunk.loading) {
+            dmThreat.cancelWork(chunkIdx, chunk);
         }
     };
 
-    int rd = int((camera.gridSize - 1) / 2);
-
-    for (int chunk_distance = 0; chunk_distance <= std::max(rd, int(camera.gridHeight));
-         chunk_distance++) {
-        for (int dz = -chunk_distance; dz <= chunk_distance; ++dz) {
-            if (dz > int(camera.gridHeight)) {
-                break;
-            }
-            for (int dy = -chunk_distance; dy <= chunk_distance; ++dy) {
-                if (abs(dy) > rd) {
-                    continue;
-                }
-                for (int dx = -chunk_distance; dx <= chunk_distance; ++dx) {
-                    if (abs(dx) > rd) {
-                        continue;
-                    }
-                    // Only process the *outer shell* at this distance
-                    if (abs(dx) != chunk_distance &&
-                        abs(dy) != chunk_distance &&
-                        abs(dz) != chunk_distance)
-                        continue;
-
-                    processOffset(dx, dy, dz);
-                }
+    //Nothing changes for a slot until the camera enters another chunk or something happens to the slot, so most
+    //frames only look at a handful of slots or none at all.
+    std::vector<uint32_t> changedSlots;
+    if (dmThreat.takeChangedSlots(changedSlots)) {
+        for (const LodShellCell &cell: shellTable.shells()) {
+            processCell(cell);
+        }
+    } else {
+        for (uint32_t chunkIdx: changedSlots) {
+            glm::ivec3 gridCoord(chunkIdx % camera.gridSize, (chunkIdx / camera.gridSize) % camera.gridSize,
+                                 chunkIdx / (camera.gridSize * camera.gridSize));
+            if (const LodShellCell *cell = shellTable.find(shellTable.offsetOf(gridCoord, center))) {
+                processCell(*cell);
             }
         }
     }
+    dmThreat.recordFrame();
 }
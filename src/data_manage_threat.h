@@ -9,32 +9,75 @@
 #include <functional>
 #include <atomic>
 
+#include "async_chunk_io.h"
+#include "chunk_cache.h"
+#include "chunk_planner.h"
+#include "chunk_write_queue.h"
+#include "octree_pool.h"
+#include "pool_allocator.h"
+#include "residency_manager.h"
 #include "structures.h"
 #include "voxelizer.h"
 #include "scene_metadata.h"
 #include "config.h"
+#include "staging_ring.h"
+#include "traversal_feedback.h"
+#include "upload_budget.h"
 
 //TODO: start using paths as func arguments for all the load, unload functionality
 struct ChunkLoadInfo {
     glm::ivec3 gridCoord;
     uint32_t resolution;
     glm::ivec3 chunkCoord;
+    //Generation of the grid slot this job was made for, once the slot gets a new target the job is stale.
+    uint32_t generation = 0;
+    //Loads into the overview, gridCoord is then the position in the overview.
+    bool overview = false;
+    //The chunk is outside the view, and resolution is this many LOD levels coarser than it would be in view.
+    bool outsideView = false;
+    uint32_t offscreenLevels = 0;
 };
 
-namespace fs = std::filesystem;
-
-// Computes discrete LOD level based on distance
-inline uint32_t computeLOD(float distance) {
-    distance = std::max(distance, 1.0f); // avoid log2(0)
-    return static_cast<uint32_t>(std::floor(std::log2(distance)));
+//LOD delta used for a slot that holds a different chunk, or nothing, which is worse than any resolution mismatch.
+constexpr float MISSING_CHUNK_LOD_DELTA = 8.0f;
+
+//Part of the priority a chunk outside the view cone keeps.
+constexpr float OUTSIDE_VIEW_PRIORITY = 0.25f;
+
+//How important it is to load a chunk, higher goes first. Near chunks in front of the camera that are furthest off
+//from their wanted resolution matter most. Chunks behind the camera still count for a bit, turning around is quick.
+inline float chunkPriority(glm::ivec3 offset, glm::vec3 viewDirection, float lodDelta, bool outsideView = false) {
+    float distance = glm::length(glm::vec3(offset));
+    float facing = distance > 0.0f ? glm::dot(glm::vec3(offset) / distance, glm::normalize(viewDirection)) : 1.0f;
+    float angleWeight = 0.25f + 0.75f * std::max(facing, 0.0f);
+    if (outsideView) {
+        angleWeight *= OUTSIDE_VIEW_PRIORITY;
+    }
+    return angleWeight * (1.0f + lodDelta) / (1.0f + distance);
 }
 
-// Computes chunk resolution (in voxels per edge)
-inline uint32_t calculateChunkResolution(uint32_t maxResolution, float distance) {
-    uint32_t lod = computeLOD(distance);
-    uint32_t resolution = maxResolution >> lod; // divide by 2^lod
-    return std::min(1024u, std::max(resolution, 8u)); // clamp to some minimum
-}
+struct QueuedChunk {
+    ChunkLoadInfo job;
+    float lodDelta;
+    float priority;
+
+    //Orders the heap so the highest priority is on top
+    bool operator<(const QueuedChunk &other) const { return priority < other.priority; }
+};
+
+//Guesses where the camera is heading from how it moved over the last frames.
+struct CameraMotion {
+    glm::vec3 lastPosition{0.0f};
+    //Smoothed, in voxels per second
+    glm::vec3 velocity{0.0f};
+    double lastTime = -1.0;
+
+    void update(glm::vec3 position, double time);
+
+    glm::vec3 predict(double secondsAhead) const { return lastPosition + velocity * static_cast<float>(secondsAhead); }
+};
+
+namespace fs = std::filesystem;
 
 // inline uint32_t calculateChunkResolution(uint32_t maxChunkResolution, float dist) {
 //     float distance = std::max(dist, 1.0f);
@@ -58,35 +101,78 @@ public:
 
     size_t allocateChunk(size_t size);
 
+    //Allocate entirely before limit, for moving an allocation to the front of the buffer. Returns 0 without logging
+    //when nothing fits.
+    size_t allocateChunkBelow(size_t size, size_t limit);
+
     void freeChunk(size_t offset);
 
+    //Part of the free memory that is not in the largest free block.
+    double fragmentation();
+
     void printBufferInfo();
 
 private:
-    struct DataChunk {
-        size_t offset;
-        size_t elementSize;
-        bool occupied;
-    };
-
     //Buffer size in allowed elements, so if type is uin32_t, byte size would be bufferSize * sizeof(uint32_t)
     uint32_t bufferSize;
-    std::vector<DataChunk> chunks;
+    PoolAllocator allocator;
     std::mutex mut;
     const std::string name;
     size_t itemSize;
 };
 
+//A chunk of which the GPU and staging memory is allocated, waiting for its data to arrive in the staging buffer.
+struct PendingChunkUpload {
+    ChunkLoadInfo job;
+    uint32_t chunkIdx = 0;
+    std::unique_ptr<ChunkFile> file;
+    uint32_t rootNodeIndex = 0;
+    uint32_t farValuesOffset = 0;
+    //Nodes followed by the node colors
+    size_t octreeElements = 0;
+    uint32_t colorsOffset = 0;
+    uint32_t treeLevels = 0;
+    size_t farValuesElements = 0;
+    //Offsets in the staging buffer
+    size_t octreeIndex = 0;
+    size_t farValueIndex = 0;
+};
+
+//Everything a streaming worker needs for itself.
+struct StreamingWorker {
+    std::thread thread;
+    //Textures get loaded lazily by the voxelizer
+    std::map<std::string, LoadedTexture> textures;
+};
+
 struct TransferInformation {
     uint32_t chunk_idx;
+    uint32_t generation;
+    //Chunk table entry, octree and far values in the staging buffer. The last two are 0 for empty chunks.
     size_t staging_offset;
+    size_t octree_staging_offset;
+    size_t far_values_staging_offset;
     CpuChunk newChunk;
+    //Only the chunk table entry changes, the octree and far values are the ones the slot already has.
+    bool inPlace = false;
+};
+
+//Staging memory that can be freed once the upload timeline reaches timelineValue, and the old location of chunks that
+//got moved by the compaction.
+struct RetiringStaging {
+    uint64_t timelineValue;
+    std::vector<size_t> stagingOffsets;
+    std::vector<size_t> octreeOffsets;
+    std::vector<size_t> farValuesOffsets;
 };
 
+//Amount of upload submissions that can be in flight before the main thread stops recording new ones.
+constexpr size_t UPLOAD_BATCHES_IN_FLIGHT = 3;
+
 class DataManageThreat {
 public:
     DataManageThreat(VkDevice &device, StagingBufferProperties &stagingBufferProperties, Config &config,
-                     BufferManager &octreeGPUManager, BufferManager &stagingBufferManager,
+                     OctreePool &octreeGPUManager, StagingRing &stagingRing,
                      VkBuffer &chunkBuffer, BufferManager &farValuesManager,
                      std::optional<SceneMetadata> objFile,
                      std::vector<CpuChunk> &chunks,
@@ -94,37 +180,163 @@ public:
 
     ~DataManageThreat();
 
-    void pushWork(ChunkLoadInfo job);
+    //Queue a new target for the grid slot, replacing any job still queued or running for it.
+    //Has to be called from the main thread, which owns the grid.
+    void pushWork(ChunkLoadInfo job, const CpuChunk &current);
+
+    //The slot already shows what it should, drop the job that was still going for it.
+    void cancelWork(uint32_t chunkIdx, CpuChunk &current);
+
+    //Re-score the queued jobs once the camera moved to another chunk.
+    void rescoreWork();
+
+    //Whether the slot held its chunk for long enough that its resolution may be changed.
+    bool lodChangeAllowed(uint32_t chunkIdx) const;
+
+    //Load the chunks around where the camera is expected to be into the chunk cache, only while there are no jobs
+    //for the grid. Replaces the previous prediction. Has to be called from the main thread.
+    void prefetch(glm::ivec3 predictedChunk);
+
+    //Count a rendered frame for the stats, with whether any grid slot did not hold its chunk yet.
+    void recordFrame();
+
+    //Whether the grid slot holds what checkChunks wants it to, for the stats.
+    void setSlotMissing(uint32_t chunkIdx, bool missing);
+
+    //The grid slots checkChunks has to look at again, because a load for them landed or failed, their residency cap
+    //changed or their LOD change is allowed now. Returns true when the camera moved to another chunk since the last
+    //call and the whole grid has to be looked at. Main thread only.
+    bool takeChangedSlots(std::vector<uint32_t> &slots);
+
+    //The slot wants another resolution but has not held its chunk for long enough, look at it again once it has.
+    void recheckWhenLodChangeAllowed(uint32_t chunkIdx);
+
+    //The view cone plus guard band of the camera, for the chunks that get loaded coarser outside it.
+    ViewCone viewCone() const;
+
+    //Take the traversal feedback of the last frame the GPU finished, one value per grid slot. Main thread only.
+    void applyTraversalFeedback(const uint32_t *values);
+
+    //Resolution the rays needed in the grid slot, 0 when none entered it and UINT32_MAX when that is not known or
+    //traversal feedback is off.
+    uint32_t feedbackResolution(uint32_t chunkIdx) const;
+
+    const LodShellTable &lodShells() const { return shellTable; }
+
+    uint32_t offscreenLodLevels() const { return config.offscreenLodLevels; }
+
+    //Queue the overview chunks around the camera that the overview does not hold or load yet. Main thread only.
+    void updateOverview();
+
+    //Evict or downgrade the least important grid chunks when over the GPU memory budget or when a load could not get
+    //its memory. Main thread only.
+    void relieveMemoryPressure();
+
+    //Resolution the slot may load chunkCoord at after memory pressure, 0 when it has to stay empty.
+    uint32_t residencyCap(uint32_t chunkIdx, glm::ivec3 chunkCoord, uint32_t resolution) const;
+
+    //Keep the slot empty for chunkCoord, evicting what it holds or loads. Main thread only.
+    void keepEmpty(uint32_t chunkIdx, glm::ivec3 chunkCoord, CpuChunk &current);
+
+    //Whether the slot is on its way to being emptied.
+    bool evictionPending(uint32_t chunkIdx) const;
 
     bool CheckToWaitAndStartTransfer();
 
-private:
-    std::thread workerThread;
-    std::queue<ChunkLoadInfo> workQueue;
-    std::mutex queueMutex;
-    std::condition_variable cv;
-    bool stopFlag;
+    void printStats();
 
+private:
+    //First, the members below are sized from the config and the grid
     Config &config;
     StagingBufferProperties &stagingBufferProperties;
     std::vector<CpuChunk> &chunks;
     CPUCamera &camera;
     VkDevice &device;
-    VkCommandPool threadCommandPool;
-    VkCommandBuffer threadCommandBuffer;
-    // std::array<VkCommandBuffer, 2> commandBuffers;
-    BufferManager &stagingBufferManager;
-    BufferManager &octreeGPUManager;
+    StagingRing &stagingRing;
+    OctreePool &octreeGPUManager;
     BufferManager &farValuesManager;
     VkBuffer &chunkBuffer;
+
+    std::vector<std::unique_ptr<StreamingWorker> > workers;
+    //Binary heap on priority
+    std::vector<QueuedChunk> workQueue;
+    std::mutex queueMutex;
+    std::condition_variable cv;
+    bool stopFlag;
+    //Bumped every time a slot gets a new target, workers drop jobs with an older generation. Slots are the entries of
+    //the chunk table, so the grid followed by the overview.
+    std::vector<std::atomic<uint32_t> > slotGenerations;
+    //The chunk every slot is currently being loaded with, only used by the main thread.
+    std::vector<ChunkKey> slotTargets;
+    //What the overview entries of the chunk table hold, only used by the main thread.
+    std::vector<CpuChunk> overviewChunks;
+    //Overview jobs, only loaded while there are no grid jobs. Guarded by queueMutex.
+    std::deque<ChunkLoadInfo> overviewQueue;
+    std::optional<glm::ivec3> lastOverviewChunk;
+    glm::ivec3 lastCameraChunk;
+    //When every slot got the chunk it holds, and the resolution it held before a LOD change. Main thread only.
+    std::vector<std::chrono::steady_clock::time_point> slotResidentSince;
+    std::vector<uint32_t> slotPreviousResolution;
+    //LOD changes of the last minute, and the ones going back to the resolution a slot just had
+    std::deque<std::chrono::steady_clock::time_point> lodChanges;
+    std::deque<std::chrono::steady_clock::time_point> lodFlips;
+    std::atomic<uint64_t> cancelledJobs = 0;
+    //Chunks to load into the cache ahead of the camera, nearest to the prediction first. Guarded by queueMutex.
+    std::deque<ChunkKey> prefetchQueue;
+    glm::ivec3 lastPrefetchChunk;
+    std::atomic<uint32_t> activePrefetches = 0;
+    //Prefetched chunks no grid slot asked for yet
+    ChunkKeySet prefetchedKeys;
+    std::mutex prefetchMutex;
+    std::atomic<uint64_t> prefetchedChunks = 0;
+    std::atomic<uint64_t> prefetchHits = 0;
+    uint64_t prefetchesEvicted = 0;
+    //Only touched by the main thread
+    uint64_t frames = 0;
+    uint64_t framesMissingChunks = 0;
+    std::vector<bool> slotMissing;
+    size_t missingSlots = 0;
+    LodShellTable shellTable;
+    //Grid slots checkChunks has to look at next frame, and the camera chunk it last looked at the whole grid for
+    std::vector<uint32_t> changedSlots;
+    std::vector<bool> slotChanged;
+    std::optional<glm::ivec3> lastCheckedChunk;
+    //View direction of the last full check, turning far enough from it checks the whole grid again
+    glm::vec3 lastCheckedDirection{0.0f};
+    std::atomic<uint64_t> offscreenUploads = 0;
+    std::atomic<uint64_t> offscreenBytesSaved = 0;
+    //When slots held back by lodMinResidencySeconds may change, soonest on top
+    std::priority_queue<std::pair<std::chrono::steady_clock::time_point, uint32_t>,
+        std::vector<std::pair<std::chrono::steady_clock::time_point, uint32_t> >, std::greater<> > lodRechecks;
+    //GPU memory of the octrees and far values held by the grid, which the budget is for, and by the overview
+    size_t gridResidentBytes = 0;
+    size_t overviewResidentBytes = 0;
     std::string objFile;
     std::string objDirectory;
     std::string directory;
-    VkFence transferFence;
-    VkFence gridFence;
+
+    //Signalled with an increasing value by every upload submission
+    VkSemaphore uploadTimeline;
+    uint64_t uploadTimelineValue = 0;
+    std::array<VkCommandBuffer, UPLOAD_BATCHES_IN_FLIGHT> uploadCommandBuffers{};
+    //Timeline value each command buffer was last submitted with
+    std::array<uint64_t, UPLOAD_BATCHES_IN_FLIGHT> uploadBatchValues{};
+    std::deque<RetiringStaging> retiringStaging;
+    std::atomic<uint64_t> uploadedChunks = 0;
+    std::atomic<uint64_t> uploadBatches = 0;
+    std::atomic<uint64_t> uploadStalls = 0;
+    uint64_t inPlaceLODChanges = 0;
+    uint64_t inPlaceBytesSaved = 0;
+    uint64_t compactedChunks = 0;
+    uint64_t compactedBytes = 0;
+    //Compaction pauses for a bit after it found nothing to move
+    std::chrono::steady_clock::time_point compactionIdleUntil;
+    //Only used by the main thread
+    UploadBudget uploadBudget;
+    ResidencyManager residency;
+    TraversalFeedback traversalFeedback;
 
     std::vector<TexturedTriangle> triangles;
-    std::map<std::string, LoadedTexture> textures;
 
     glm::ivec2 cameraChunk;
 
@@ -133,31 +345,92 @@ private:
     void *gpuDataPointer;
 
     std::queue<TransferInformation> transferQueue;
-    std::queue<TransferInformation> chunkDeleteQueue;
+    //Grid slots whose load got cancelled or failed, the main thread owns the grid so it clears their loading flag.
+    std::vector<std::pair<uint32_t, uint32_t> > releasedSlots;
     std::mutex transferQueueMutex;
 
     bool sceneLoaded = false;
+    std::mutex sceneMutex;
+
+    AsyncChunkReader chunkReader;
+    //Chunks whose payload is being read from disk, keyed by the id handed to the chunkReader.
+    std::unordered_map<uint64_t, PendingChunkUpload> pendingUploads;
+    std::mutex uploadsMutex;
+    std::atomic<size_t> pendingUploadCount = 0;
+    std::atomic<uint64_t> nextUploadId = 0;
+    std::unique_ptr<ChunkWriteQueue> chunkWriter;
+    ChunkCache chunkCache;
 
     void loadObj();
 
-    void initFence();
+    void initUploadPipeline();
+
+
+    void threadLoop(StreamingWorker &worker);
+
+    //Can be called from any worker, the slot gets released on the main thread if the job is still current.
+    void releaseSlot(uint32_t chunkIdx, uint32_t generation);
+
+    uint32_t slotIndex(glm::ivec3 gridCoord) const;
+
+    //Chunk table entry of a chunk in the overview, which wraps around like the grid.
+    uint32_t overviewIndex(glm::ivec3 overviewCoord) const;
+
+    uint32_t slotIndex(const ChunkLoadInfo &job) const;
+
+    CpuChunk &slotChunk(uint32_t chunkIdx);
+
+    //Whether nothing newer got queued for the slot since the job was made.
+    bool isCurrent(const ChunkLoadInfo &job) const;
+
+    void loadChunkToGPU(ChunkLoadInfo job, StreamingWorker &worker);
+
+    bool allocateChunkUpload(PendingChunkUpload &upload);
+
+    //Tell the residency manager a grid load could not get its GPU memory.
+    void reportFailedAllocation(const PendingChunkUpload &upload);
+
+    //Point the chunk table entry of the slot at nothing and free its memory once the copy is recorded. Returns false
+    //when there is no staging memory for it this frame.
+    bool evictSlot(uint32_t chunkIdx, glm::ivec3 chunkCoord);
+
+    //Have checkChunks look at the grid slot next frame.
+    void markSlotChanged(uint32_t chunkIdx);
+
+    void releaseChunkUpload(PendingChunkUpload &upload);
+
+    //Read or generate a chunk into the cache without uploading it.
+    void prefetchChunk(const ChunkKey &key, StreamingWorker &worker);
+
+    //Draw the resident tree of the slot at the resolution of the job by only updating its chunk table entry. Works when
+    //the slot holds the same chunk at the job resolution or finer, returns false when it has to be loaded.
+    bool changeLODInPlace(const ChunkLoadInfo &job, const CpuChunk &current);
+
+    void setUploadSizes(PendingChunkUpload &upload, const ChunkData &data);
 
-    void initCommandBuffers();
+    //Whether a pool is fragmented enough to move chunks this frame.
+    bool compactionDue();
 
+    //Record moving resident chunks from the end of the fragmented pools to free blocks before them, up to the
+    //compaction budget. Their old memory is freed once the batch retired. Returns the amount of chunks moved.
+    uint32_t compactPools(VkCommandBuffer commandBuffer, RetiringStaging &retiring);
 
-    void threadLoop();
+    void copyToStaging(const PendingChunkUpload &upload, const ChunkData &data);
 
-    void loadChunkToGPU(ChunkLoadInfo job);
+    //Copy a chunk the async reader read into staging back out for the cache, before its staging memory is handed over.
+    std::shared_ptr<ChunkData> copyFromStaging(const PendingChunkUpload &upload);
 
-    bool checkChunkResolution(const ChunkLoadInfo &job);
+    //Hand a chunk whose data is in the staging buffer over to the main thread, which batches the copies.
+    void submitChunkUpload(PendingChunkUpload &upload);
 
-    void loadChunkData(ChunkLoadInfo &job, std::vector<uint32_t> &chunkFarValues,
-                       std::vector<uint32_t> &chunkOctreeGPU);
+    //Generate a chunk that is not on disk yet, returns the amount of nodes in the generated octree.
+    uint32_t generateChunkData(ChunkLoadInfo &job, std::vector<uint32_t> &chunkFarValues,
+                               std::vector<uint32_t> &chunkOctreeGPU, StreamingWorker &worker);
 };
 
 
-//Check whether all currently loaded chunks are in the right resolution and queue them to be loaded if not
-void checkChunks(std::vector<CpuChunk> &chunks, CPUCamera &camera, uint32_t maxChunkResolution, float voxelScale, float scaleDistance,
-                 DataManageThreat &dmThreat);
+//Check whether the loaded chunks are in the right resolution and queue them to be loaded if not. Only looks at the
+//slots something happened to, or every slot once the camera moved to another chunk.
+void checkChunks(std::vector<CpuChunk> &chunks, CPUCamera &camera, DataManageThreat &dmThreat);
 
 #endif //DATA_MANAGE_THREAT_H
@@ -0,0 +1,324 @@
+#include "octree_pool.h"
+
+#include <bit>
+#include <chrono>
+
+#include "spdlog/spdlog.h"
+
+//Smallest size class of the bindless chunk buffers, 4 KB
+constexpr size_t MIN_CHUNK_BUFFER_ELEMENTS = 1 << 10;
+
+OctreePool::OctreePool(const std::vector<VkBuffer> &buffers, size_t bufferElements, size_t lastBufferElements,
+                       uint32_t maxBuffers, const std::string &name)
+    : bufferElements(bufferElements), maxBuffers(std::max<uint32_t>(maxBuffers, buffers.size())), buffers(buffers),
+      name(name) {
+    for (size_t i = 0; i < buffers.size(); i++) {
+        //Every buffer starts at offset 1, so 0 stays reserved in the first one and the offsets of the others line up.
+        allocators.emplace_back(i + 1 == buffers.size() ? lastBufferElements : bufferElements);
+    }
+}
+
+OctreePool::OctreePool(VkBuffer placeholder, size_t maxElements, uint32_t maxBuffers, VkDeviceSize budgetBytes,
+                       VkDeviceSize spareBytes, BufferCreator createBuffer, const std::string &name)
+    : bindless(true), bufferElements(maxElements), maxBuffers(maxBuffers), buffers{placeholder},
+      createBuffer(std::move(createBuffer)), budgetBytes(budgetBytes), spareLimit(spareBytes), name(name) {
+    ChunkBuffer empty{};
+    empty.buffer = placeholder;
+    empty.bound = true;
+    chunkBuffers.push_back(empty);
+}
+
+size_t OctreePool::allocateChunk(size_t size) {
+    if (size == 0) {
+        spdlog::error("Tried allocating 0 memory in the {}!", name);
+        return 0;
+    }
+    if (bindless) {
+        //Takes the lock itself, without holding it while the buffer gets created
+        return allocateChunkBuffer(size);
+    }
+    std::lock_guard<std::mutex> lock(mut);
+    //First buffer with room, so the later buffers stay empty for as long as possible.
+    for (size_t i = 0; i < allocators.size(); i++) {
+        size_t offset = allocators[i].allocate(size);
+        if (offset != 0) {
+            return (i * bufferElements) | offset;
+        }
+    }
+    failedAllocations++;
+    if (size < bufferElements && buffers.size() < maxBuffers) {
+        growRequested = true;
+    } else {
+        spdlog::error("No possible location to allocate {} elements in the {}!", size, name);
+    }
+    return 0;
+}
+
+size_t OctreePool::allocateChunkBelow(size_t size, size_t limit) {
+    std::lock_guard<std::mutex> lock(mut);
+    if (bindless) {
+        return 0;
+    }
+    size_t limitBuffer = limit / bufferElements;
+    for (size_t i = 0; i <= limitBuffer && i < allocators.size(); i++) {
+        size_t localLimit = i < limitBuffer ? bufferElements : localOffset(limit);
+        size_t offset = allocators[i].allocateBelow(size, localLimit);
+        if (offset != 0) {
+            return (i * bufferElements) | offset;
+        }
+    }
+    return 0;
+}
+
+void OctreePool::freeChunk(size_t offset) {
+    std::lock_guard<std::mutex> lock(mut);
+    if (bindless) {
+        freeChunkBuffer(static_cast<uint32_t>(offset));
+        return;
+    }
+    size_t buffer = offset / bufferElements;
+    if (buffer >= allocators.size() || !allocators[buffer].free(localOffset(offset))) {
+        spdlog::error("Tried to free an offset that is not allocated in the {}!", name);
+    }
+}
+
+VkBuffer OctreePool::bufferFor(size_t offset) {
+    std::lock_guard<std::mutex> lock(mut);
+    if (bindless) {
+        return chunkBuffers[offset].buffer;
+    }
+    return buffers[offset / bufferElements];
+}
+
+size_t OctreePool::localOffset(size_t offset) const {
+    //Chunk buffers keep element 0 unused, index 0 is no node in the shader
+    return bindless ? 1 : offset & (bufferElements - 1);
+}
+
+uint32_t OctreePool::shaderRoot(size_t offset) const {
+    return static_cast<uint32_t>(bindless && offset != 0 ? 1 : offset);
+}
+
+uint32_t OctreePool::shaderBuffer(size_t offset) const {
+    return static_cast<uint32_t>(bindless ? offset : 0);
+}
+
+uint32_t OctreePool::bufferShift() const {
+    //Every node index of a chunk buffer is below 1 << 31, so the shift leaves only the index of the chunk table entry
+    return bindless ? 31u : static_cast<uint32_t>(std::countr_zero(bufferElements));
+}
+
+bool OctreePool::isBound(size_t offset) {
+    if (!bindless) {
+        return true;
+    }
+    std::lock_guard<std::mutex> lock(mut);
+    return chunkBuffers[offset].bound;
+}
+
+void OctreePool::addBuffer(VkBuffer buffer) {
+    std::lock_guard<std::mutex> lock(mut);
+    //A smaller last buffer would leave a gap in the offsets, it keeps its size and the new one comes after the gap.
+    buffers.push_back(buffer);
+    allocators.emplace_back(bufferElements);
+    growRequested = false;
+    spdlog::info("{} grew to {} buffers", name, buffers.size());
+}
+
+void OctreePool::bindNewBuffers(const std::function<void(uint32_t index, VkBuffer buffer)> &bind,
+                                const std::function<void(VkBuffer buffer, VkDeviceMemory memory)> &destroy) {
+    std::lock_guard<std::mutex> lock(mut);
+    for (uint32_t index: unboundIndices) {
+        //Can be destroyed already, or hold a buffer that is still being created and gets bound next time
+        ChunkBuffer &chunkBuffer = chunkBuffers[index];
+        if (chunkBuffer.buffer != VK_NULL_HANDLE && !chunkBuffer.bound) {
+            bind(index, chunkBuffer.buffer);
+            chunkBuffer.bound = true;
+        }
+    }
+    unboundIndices.clear();
+    //The descriptors of these can still point at them, but no chunk table entry does anymore
+    for (auto [buffer, memory]: destroyQueue) {
+        destroy(buffer, memory);
+    }
+    destroyQueue.clear();
+}
+
+void OctreePool::destroyChunkBuffers(const std::function<void(VkBuffer buffer, VkDeviceMemory memory)> &destroy) {
+    std::lock_guard<std::mutex> lock(mut);
+    for (auto [buffer, memory]: destroyQueue) {
+        destroy(buffer, memory);
+    }
+    destroyQueue.clear();
+    //Index 0 is the placeholder the application created
+    for (size_t i = 1; i < chunkBuffers.size(); i++) {
+        if (chunkBuffers[i].buffer != VK_NULL_HANDLE) {
+            destroy(chunkBuffers[i].buffer, chunkBuffers[i].memory);
+        }
+        chunkBuffers[i] = ChunkBuffer{};
+    }
+}
+
+size_t OctreePool::allocateChunkBuffer(size_t size) {
+    //Element 0 stays unused
+    size_t elements = std::max(std::bit_ceil(size + 1), MIN_CHUNK_BUFFER_ELEMENTS);
+    VkDeviceSize bytes = elements * sizeof(uint32_t);
+    uint32_t index;
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        if (elements > bufferElements) {
+            failedAllocations++;
+            spdlog::error("Chunk of {} elements does not fit in a single buffer of the {}!", size, name);
+            return 0;
+        }
+        auto spare = spareBuffers.find(elements);
+        if (spare != spareBuffers.end() && !spare->second.empty()) {
+            index = spare->second.back();
+            spare->second.pop_back();
+            spareBytes -= bytes;
+            chunkBuffers[index].used = size;
+            buffersReused++;
+            return index;
+        }
+
+        auto full = [&] {
+            return allocatedBytes + bytes > budgetBytes || (freeIndices.empty() && chunkBuffers.size() >= maxBuffers);
+        };
+        //Spare buffers of the other size classes make room first
+        while (full() && destroySpareBuffer()) {
+        }
+        if (full()) {
+            failedAllocations++;
+            spdlog::error("No room for another buffer of {} elements in the {}!", elements, name);
+            return 0;
+        }
+        if (freeIndices.empty()) {
+            index = static_cast<uint32_t>(chunkBuffers.size());
+            chunkBuffers.emplace_back();
+        } else {
+            index = freeIndices.back();
+            freeIndices.pop_back();
+        }
+        chunkBuffers[index].elements = elements;
+        chunkBuffers[index].used = size;
+        allocatedBytes += bytes;
+    }
+
+    //Creating the buffer takes a while, the other workers can keep allocating meanwhile.
+    VkBuffer buffer = VK_NULL_HANDLE;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    auto start = std::chrono::steady_clock::now();
+    bool created = createBuffer(bytes, buffer, memory);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    std::lock_guard<std::mutex> lock(mut);
+    creationMs += ms;
+    if (!created) {
+        allocatedBytes -= bytes;
+        chunkBuffers[index] = ChunkBuffer{};
+        freeIndices.push_back(index);
+        failedAllocations++;
+        spdlog::error("Could not create a buffer of {} elements for the {}!", elements, name);
+        return 0;
+    }
+    chunkBuffers[index].buffer = buffer;
+    chunkBuffers[index].memory = memory;
+    unboundIndices.push_back(index);
+    buffersCreated++;
+    return index;
+}
+
+void OctreePool::freeChunkBuffer(uint32_t index) {
+    if (index == 0 || index >= chunkBuffers.size() || chunkBuffers[index].used == 0) {
+        spdlog::error("Tried to free a buffer that is not allocated in the {}!", name);
+        return;
+    }
+    ChunkBuffer &chunkBuffer = chunkBuffers[index];
+    chunkBuffer.used = 0;
+    VkDeviceSize bytes = chunkBuffer.elements * sizeof(uint32_t);
+    if (spareBytes + bytes <= spareLimit) {
+        spareBuffers[chunkBuffer.elements].push_back(index);
+        spareBytes += bytes;
+        return;
+    }
+    destroyQueue.emplace_back(chunkBuffer.buffer, chunkBuffer.memory);
+    allocatedBytes -= bytes;
+    chunkBuffer = ChunkBuffer{};
+    freeIndices.push_back(index);
+}
+
+bool OctreePool::destroySpareBuffer() {
+    for (auto it = spareBuffers.rbegin(); it != spareBuffers.rend(); ++it) {
+        if (it->second.empty()) {
+            continue;
+        }
+        uint32_t index = it->second.back();
+        it->second.pop_back();
+        ChunkBuffer &chunkBuffer = chunkBuffers[index];
+        VkDeviceSize bytes = chunkBuffer.elements * sizeof(uint32_t);
+        spareBytes -= bytes;
+        allocatedBytes -= bytes;
+        destroyQueue.emplace_back(chunkBuffer.buffer, chunkBuffer.memory);
+        chunkBuffer = ChunkBuffer{};
+        freeIndices.push_back(index);
+        return true;
+    }
+    return false;
+}
+
+uint32_t OctreePool::bufferCount() {
+    std::lock_guard<std::mutex> lock(mut);
+    if (bindless) {
+        return static_cast<uint32_t>(chunkBuffers.size() - freeIndices.size());
+    }
+    return static_cast<uint32_t>(buffers.size());
+}
+
+double OctreePool::fragmentation() {
+    std::lock_guard<std::mutex> lock(mut);
+    //The worst buffer decides, every buffer gets compacted on its own.
+    double worst = 0.0;
+    for (const auto &allocator: allocators) {
+        worst = std::max(worst, allocator.externalFragmentation());
+    }
+    return worst;
+}
+
+void OctreePool::printBufferInfo() {
+    std::lock_guard<std::mutex> lock(mut);
+    auto toMB = [](size_t elements) { return static_cast<double>(elements * sizeof(uint32_t)) / (1024.0 * 1024.0); };
+    if (bindless) {
+        size_t used = 0;
+        size_t spare = 0;
+        for (const auto &chunkBuffer: chunkBuffers) {
+            used += chunkBuffer.used;
+        }
+        for (const auto &[elements, indices]: spareBuffers) {
+            spare += indices.size();
+        }
+        size_t allocated = allocatedBytes / sizeof(uint32_t);
+        spdlog::info("{} {} chunk buffers ({} spare) of max {}, {:.2f} MB allocated, {:.2f} MB used, {:.2f}% lost to "
+                     "size classes", name, chunkBuffers.size() - 1 - freeIndices.size(), spare, maxBuffers,
+                     toMB(allocated), toMB(used),
+                     allocated == 0 ? 0.0 : (1.0 - static_cast<double>(used) / static_cast<double>(allocated)) * 100.0);
+        spdlog::info("{} {} buffers created in {:.2f} ms, {} reused, {} failed allocations", name, buffersCreated,
+                     creationMs, buffersReused, failedAllocations);
+        return;
+    }
+    size_t used = 0;
+    size_t capacity = 0;
+    size_t largestFree = 0;
+    size_t freeBlocks = 0;
+    for (const auto &allocator: allocators) {
+        used += allocator.used();
+        capacity += allocator.capacity();
+        largestFree = std::max(largestFree, allocator.largestFree());
+        freeBlocks += allocator.freeBlocks();
+    }
+    spdlog::info("{} Memory used: {:.2f} MB, Memory Free: {:.2f} MB, Percentage used {:.2f}%, {}/{} buffers", name,
+                 toMB(used), toMB(capacity - used),
+                 capacity == 0 ? 0.0 : static_cast<double>(used) / static_cast<double>(capacity) * 100.0,
+                 buffers.size(), maxBuffers);
+    spdlog::info("{} Largest free block: {:.2f} MB, {} free blocks, {} failed allocations", name, toMB(largestFree),
+                 freeBlocks, failedAllocations);
+}
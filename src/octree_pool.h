@@ -0,0 +1,125 @@
+#pragma once
+
+#ifndef OCTREE_POOL_H
+#define OCTREE_POOL_H
+#include <atomic>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include "pool_allocator.h"
+
+//The octree nodes of every chunk, on the GPU in one of two ways.
+//Pool: spread over the VoxelSSBO buffers. Every buffer is bufferElements apart in the offsets handed out, a power of
+//two, so the shader finds the buffer of a node with a shift. An allocation never spans two buffers. When nothing fits
+//a new buffer gets requested, which the main thread creates, up to maxBuffers.
+//Bindless: every chunk gets a buffer of its own, rounded up to a power of two size class, bound at its own index of
+//the VoxelSSBO array. The handle of a chunk is that index, index 0 is the buffer empty chunk table entries point at.
+//Freed buffers are kept per size class for reuse, so there is no external fragmentation at all.
+class OctreePool {
+public:
+    using BufferCreator = std::function<bool(VkDeviceSize size, VkBuffer &buffer, VkDeviceMemory &memory)>;
+
+    OctreePool(const std::vector<VkBuffer> &buffers, size_t bufferElements, size_t lastBufferElements,
+               uint32_t maxBuffers, const std::string &name);
+
+    //Bindless mode, at most maxBuffers chunk buffers of at most maxElements each and budgetBytes together. Up to
+    //spareBytes of freed buffers are kept for reuse, the rest is destroyed.
+    OctreePool(VkBuffer placeholder, size_t maxElements, uint32_t maxBuffers, VkDeviceSize budgetBytes,
+               VkDeviceSize spareBytes, BufferCreator createBuffer, const std::string &name);
+
+    //Returns 0 when there is no room, requesting a new buffer if there can be more.
+    size_t allocateChunk(size_t size);
+
+    //Allocate entirely before limit, for moving an allocation to the front of the pool. Returns 0 without logging
+    //when nothing fits. Never moves anything in bindless mode.
+    size_t allocateChunkBelow(size_t size, size_t limit);
+
+    void freeChunk(size_t offset);
+
+    //Buffer the allocation is in, and the element within that buffer it starts at.
+    VkBuffer bufferFor(size_t offset);
+
+    size_t localOffset(size_t offset) const;
+
+    //What goes in the chunk table for an allocation, the root node index and the VoxelSSBO the index is relative to.
+    uint32_t shaderRoot(size_t offset) const;
+
+    uint32_t shaderBuffer(size_t offset) const;
+
+    uint32_t bufferShift() const;
+
+    bool isBindless() const { return bindless; }
+
+    //Whether the shader can see the buffer of the allocation yet, uploads into it have to wait until it is bound.
+    bool isBound(size_t offset);
+
+    //Whether an allocation failed for lack of room and there can be another buffer.
+    bool growthRequested() const { return growRequested.load(); }
+
+    //Add a buffer of bufferElements, main thread only. It has to be bound before anything is uploaded into it.
+    void addBuffer(VkBuffer buffer);
+
+    //Bind the chunk buffers created since the last call and destroy the ones freed for good, main thread only, while
+    //the GPU is not using the descriptor set.
+    void bindNewBuffers(const std::function<void(uint32_t index, VkBuffer buffer)> &bind,
+                        const std::function<void(VkBuffer buffer, VkDeviceMemory memory)> &destroy);
+
+    //Destroy every chunk buffer at shutdown, the pool buffers belong to the application.
+    void destroyChunkBuffers(const std::function<void(VkBuffer buffer, VkDeviceMemory memory)> &destroy);
+
+    uint32_t bufferCount();
+
+    //Part of the free memory that is not in the largest free block of a buffer.
+    double fragmentation();
+
+    void printBufferInfo();
+
+private:
+    struct ChunkBuffer {
+        VkBuffer buffer = VK_NULL_HANDLE;
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        size_t elements = 0;
+        size_t used = 0;
+        bool bound = false;
+    };
+
+    bool bindless = false;
+    size_t bufferElements;
+    uint32_t maxBuffers;
+    std::vector<VkBuffer> buffers;
+    std::vector<PoolAllocator> allocators;
+    std::atomic<bool> growRequested = false;
+    uint64_t failedAllocations = 0;
+
+    //Bindless mode
+    BufferCreator createBuffer;
+    VkDeviceSize budgetBytes = 0;
+    VkDeviceSize spareLimit = 0;
+    std::vector<ChunkBuffer> chunkBuffers;
+    std::vector<uint32_t> freeIndices;
+    //Size class in elements to the indices of the freed buffers of that class, still bound
+    std::map<size_t, std::vector<uint32_t> > spareBuffers;
+    std::vector<uint32_t> unboundIndices;
+    std::vector<std::pair<VkBuffer, VkDeviceMemory> > destroyQueue;
+    VkDeviceSize allocatedBytes = 0;
+    VkDeviceSize spareBytes = 0;
+    uint64_t buffersCreated = 0;
+    uint64_t buffersReused = 0;
+    double creationMs = 0.0;
+
+    std::mutex mut;
+    const std::string name;
+
+    size_t allocateChunkBuffer(size_t size);
+
+    void freeChunkBuffer(uint32_t index);
+
+    //Drop the biggest spare buffer, returns false when there are none. Needs the lock.
+    bool destroySpareBuffer();
+};
+
+#endif //OCTREE_POOL_H
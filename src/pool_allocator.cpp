@@ -0,0 +1,214 @@
+#include "pool_allocator.h"
+
+#include <chrono>
+#include <random>
+
+#include "spdlog/spdlog.h"
+
+PoolAllocator::PoolAllocator(size_t size) : totalSize(size - 1) {
+    //Initial offset is 1, so 0 can be reserved as a special value
+    blocks.emplace(1, Block{totalSize, false});
+    freeBySize.emplace(totalSize, 1);
+}
+
+size_t PoolAllocator::allocate(size_t size) {
+    if (size == 0) {
+        return 0;
+    }
+    auto best = freeBySize.lower_bound({size, 0});
+    if (best == freeBySize.end()) {
+        return 0;
+    }
+    return allocateFrom(best, size);
+}
+
+size_t PoolAllocator::allocateBelow(size_t size, size_t limit) {
+    if (size == 0) {
+        return 0;
+    }
+    for (auto it = freeBySize.lower_bound({size, 0}); it != freeBySize.end(); ++it) {
+        if (it->second + size <= limit) {
+            return allocateFrom(it, size);
+        }
+    }
+    return 0;
+}
+
+size_t PoolAllocator::allocateFrom(std::set<std::pair<size_t, size_t> >::iterator freeBlock, size_t size) {
+    auto [blockSize, offset] = *freeBlock;
+    freeBySize.erase(freeBlock);
+
+    auto block = blocks.find(offset);
+    block->second = {size, true};
+    if (blockSize > size) {
+        blocks.emplace_hint(std::next(block), offset + size, Block{blockSize - size, false});
+        freeBySize.emplace(blockSize - size, offset + size);
+    }
+    usedElements += size;
+    return offset;
+}
+
+bool PoolAllocator::free(size_t offset) {
+    auto block = blocks.find(offset);
+    if (block == blocks.end() || !block->second.occupied) {
+        return false;
+    }
+    usedElements -= block->second.size;
+    block->second.occupied = false;
+
+    //Merge with the free blocks on either side
+    auto next = std::next(block);
+    if (next != blocks.end() && !next->second.occupied) {
+        freeBySize.erase({next->second.size, next->first});
+        block->second.size += next->second.size;
+        blocks.erase(next);
+    }
+    if (block != blocks.begin()) {
+        auto previous = std::prev(block);
+        if (!previous->second.occupied) {
+            freeBySize.erase({previous->second.size, previous->first});
+            previous->second.size += block->second.size;
+            blocks.erase(block);
+            block = previous;
+        }
+    }
+    freeBySize.emplace(block->second.size, block->first);
+    return true;
+}
+
+size_t PoolAllocator::largestFree() const {
+    return freeBySize.empty() ? 0 : freeBySize.rbegin()->first;
+}
+
+double PoolAllocator::externalFragmentation() const {
+    size_t freeElements = totalSize - usedElements;
+    if (freeElements == 0) {
+        return 0.0;
+    }
+    return 1.0 - static_cast<double>(largestFree()) / static_cast<double>(freeElements);
+}
+
+LinearPoolAllocator::LinearPoolAllocator(size_t size) : totalSize(size) {
+    chunks.emplace_back(1, size - 1, false);
+}
+
+size_t LinearPoolAllocator::allocate(size_t size) {
+    if (size == 0) {
+        return 0;
+    }
+    auto best = chunks.end();
+    size_t bestSize = totalSize + 1;
+    for (auto it = chunks.begin(); it != chunks.end(); ++it) {
+        if (!it->occupied && it->elementSize >= size && it->elementSize < bestSize) {
+            best = it;
+            bestSize = it->elementSize;
+        }
+    }
+    if (best == chunks.end()) {
+        return 0;
+    }
+
+    size_t remaining_area = bestSize - size;
+    size_t offset = best->offset;
+    best->elementSize = size;
+    best->occupied = true;
+    if (remaining_area > 0) {
+        chunks.emplace(std::next(best), offset + size, remaining_area, false);
+    }
+    return offset;
+}
+
+bool LinearPoolAllocator::free(size_t offset) {
+    auto chunk = chunks.end();
+    for (auto it = chunks.begin(); it != chunks.end(); ++it) {
+        if (it->offset == offset) {
+            chunk = it;
+            break;
+        }
+    }
+    if (chunk == chunks.end()) {
+        return false;
+    }
+
+    auto first = chunk;
+    auto last = chunk;
+    auto newSize = chunk->elementSize;
+    if (chunk != chunks.begin() && !std::prev(chunk)->occupied) {
+        first = std::prev(chunk);
+        newSize += first->elementSize;
+    }
+    if (std::next(chunk) != chunks.end() && !std::next(chunk)->occupied) {
+        last = std::next(chunk);
+        newSize += last->elementSize;
+    }
+    first->occupied = false;
+    first->elementSize = newSize;
+    if (first != last) {
+        chunks.erase(std::next(first), std::next(last));
+    }
+    return true;
+}
+
+struct AllocatorBenchmarkResult {
+    double fillMs;
+    double churnMs;
+    uint64_t operations;
+    uint64_t failed;
+};
+
+template<typename Allocator>
+AllocatorBenchmarkResult runAllocatorBenchmark(uint32_t residentChunks, size_t poolSize) {
+    //Same seed for every allocator so they all get the same sizes and free the same chunks.
+    std::mt19937 rng(1234);
+    //Chunk sizes spread evenly over the powers of two, like the octree sizes of the different resolutions
+    std::uniform_real_distribution<double> sizeExponent(6.0, 16.0);
+    auto chunkSize = [&] { return static_cast<size_t>(std::exp2(sizeExponent(rng))); };
+
+    Allocator allocator(poolSize);
+    std::vector<size_t> resident;
+    resident.reserve(residentChunks);
+    AllocatorBenchmarkResult result{};
+
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t i = 0; i < residentChunks; i++) {
+        size_t offset = allocator.allocate(chunkSize());
+        result.failed += offset == 0;
+        resident.push_back(offset);
+    }
+    auto filled = std::chrono::steady_clock::now();
+
+    //Streaming replaces chunks in a random order, free one and load another in its place.
+    uint64_t churn = static_cast<uint64_t>(residentChunks) * 2;
+    for (uint64_t i = 0; i < churn; i++) {
+        size_t &slot = resident[std::uniform_int_distribution<size_t>(0, resident.size() - 1)(rng)];
+        if (slot != 0) {
+            allocator.free(slot);
+        }
+        slot = allocator.allocate(chunkSize());
+        result.failed += slot == 0;
+    }
+    auto done = std::chrono::steady_clock::now();
+
+    result.fillMs = std::chrono::duration<double, std::milli>(filled - start).count();
+    result.churnMs = std::chrono::duration<double, std::milli>(done - filled).count();
+    result.operations = residentChunks + churn * 2;
+    return result;
+}
+
+void benchmarkPoolAllocators(uint32_t residentChunks) {
+    //Same amount of elements as the octree buffer
+    size_t poolSize = (size_t{3} << 30) / sizeof(uint32_t);
+    residentChunks = std::max(residentChunks, 1u);
+    spdlog::info("Benchmarking pool allocators with {} resident chunks", residentChunks);
+
+    auto report = [](const char *name, const AllocatorBenchmarkResult &result) {
+        double totalMs = result.fillMs + result.churnMs;
+        spdlog::info("{}: fill {:.2f} ms, churn {:.2f} ms, {:.1f} ns per operation, {} failed allocations", name,
+                     result.fillMs, result.churnMs, totalMs * 1e6 / static_cast<double>(result.operations),
+                     result.failed);
+        return totalMs;
+    };
+    double tree = report("Size tree", runAllocatorBenchmark<PoolAllocator>(residentChunks, poolSize));
+    double linear = report("Linear scan", runAllocatorBenchmark<LinearPoolAllocator>(residentChunks, poolSize));
+    spdlog::info("Size tree is {:.1f}x as fast as the linear scan", tree > 0.0 ? linear / tree : 0.0);
+}
@@ -0,0 +1,78 @@
+#pragma once
+
+#ifndef POOL_ALLOCATOR_H
+#define POOL_ALLOCATOR_H
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <vector>
+
+//Hands out ranges of a pool in elements, best fit. Free blocks are kept in a tree ordered on size, so finding the
+//smallest block that fits is O(log n), and every block in a map on offset, so a freed block finds and merges its
+//neighbours in O(log n) as well. Offset 0 is never handed out, it means nothing fit. Not thread safe.
+class PoolAllocator {
+public:
+    explicit PoolAllocator(size_t size);
+
+    //Returns 0 when there is no free block big enough.
+    size_t allocate(size_t size);
+
+    //Best fit among the free blocks that end at or before limit, returns 0 when none fits. Used to move allocations
+    //to the front of the pool, can go over every bigger free block.
+    size_t allocateBelow(size_t size, size_t limit);
+
+    //Returns false when the offset is not allocated.
+    bool free(size_t offset);
+
+    size_t used() const { return usedElements; }
+
+    size_t capacity() const { return totalSize; }
+
+    size_t largestFree() const;
+
+    size_t freeBlocks() const { return freeBySize.size(); }
+
+    //Part of the free space that is not in the largest free block, 0 when all free space is in one block.
+    double externalFragmentation() const;
+
+private:
+    struct Block {
+        size_t size;
+        bool occupied;
+    };
+
+    size_t totalSize;
+    size_t usedElements = 0;
+    std::map<size_t, Block> blocks;
+    //Size and offset of every free block, the offset makes equal sizes go lowest offset first
+    std::set<std::pair<size_t, size_t> > freeBySize;
+
+    size_t allocateFrom(std::set<std::pair<size_t, size_t> >::iterator freeBlock, size_t size);
+};
+
+//The allocator BufferManager used before, scanning every block for the best fit. Only kept to benchmark against.
+class LinearPoolAllocator {
+public:
+    explicit LinearPoolAllocator(size_t size);
+
+    size_t allocate(size_t size);
+
+    bool free(size_t offset);
+
+private:
+    struct DataChunk {
+        size_t offset;
+        size_t elementSize;
+        bool occupied;
+    };
+
+    size_t totalSize;
+    std::vector<DataChunk> chunks;
+};
+
+//Time both allocators on the same stream of chunk allocations and frees, with residentChunks allocations kept alive
+//in a pool the size of the octree buffer, and log the results.
+void benchmarkPoolAllocators(uint32_t residentChunks);
+
+#endif //POOL_ALLOCATOR_H
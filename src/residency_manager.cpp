@@ -0,0 +1,171 @@
+#include "residency_manager.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "spdlog/spdlog.h"
+
+constexpr uint32_t NO_CAP = std::numeric_limits<uint32_t>::max();
+//Evictions for the budget go down to this part of it, so the next few loads do not go over again straight away
+constexpr double BUDGET_TARGET = 0.9;
+//Caps only get lifted while below this part of the budget, and this long after the last pressure
+constexpr double RELAX_BELOW = 0.75;
+constexpr std::chrono::seconds RELAX_AFTER(2);
+constexpr std::chrono::milliseconds RELAX_INTERVAL(250);
+
+ResidencyManager::ResidencyManager(size_t budgetBytes, uint32_t slots, uint32_t minResolution, uint32_t maxResolution)
+    : budgetBytes(budgetBytes), minResolution(minResolution), maxResolution(maxResolution),
+      caps(slots, SlotCap{glm::ivec3(0), NO_CAP}) {
+}
+
+void ResidencyManager::allocationFailed(uint32_t slot, glm::ivec3 chunkCoord, uint32_t resolution, size_t bytes) {
+    std::lock_guard<std::mutex> lock(failedMutex);
+    failed.push_back({slot, chunkCoord, resolution, bytes});
+}
+
+uint32_t ResidencyManager::cap(uint32_t slot, glm::ivec3 chunkCoord, uint32_t resolution) const {
+    //A cap is for the chunk that got evicted, once the slot moves on to another chunk it does not count anymore.
+    const SlotCap &slotCap = caps[slot];
+    if (slotCap.resolution == NO_CAP || slotCap.chunkCoord != chunkCoord) {
+        return resolution;
+    }
+    return std::min(resolution, slotCap.resolution);
+}
+
+std::vector<uint32_t> ResidencyManager::update(const std::function<std::vector<ResidentChunk>()> &resident,
+                                               size_t residentBytes,
+                                               const std::function<float(glm::ivec3 chunkCoord)> &importance) {
+    std::vector<FailedAllocation> failures; {
+        std::lock_guard<std::mutex> lock(failedMutex);
+        failures.swap(failed);
+    }
+    failedAllocations += failures.size();
+
+    bool overBudget = budgetBytes != 0 && residentBytes > budgetBytes;
+    size_t needed = overBudget ? residentBytes - static_cast<size_t>(static_cast<double>(budgetBytes) * BUDGET_TARGET)
+                        : 0;
+    float failedImportance = 0.0f;
+    for (const auto &failure: failures) {
+        needed += failure.bytes;
+        failedImportance = std::max(failedImportance, importance(failure.chunkCoord));
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (needed == 0) {
+        relax(residentBytes, importance);
+        return {};
+    }
+    lastPressure = now;
+
+    std::vector<ResidentChunk> candidates = resident();
+    std::vector<std::pair<float, size_t> > order;
+    order.reserve(candidates.size());
+    for (size_t i = 0; i < candidates.size(); i++) {
+        order.emplace_back(importance(candidates[i].chunkCoord), i);
+    }
+    std::sort(order.begin(), order.end());
+
+    //A chunk that could not be loaded while a less important one holds memory
+    if (!order.empty()) {
+        for (const auto &failure: failures) {
+            priorityInversions += importance(failure.chunkCoord) > order.front().first;
+        }
+    }
+
+    std::vector<uint32_t> evicted;
+    size_t freed = 0;
+    for (auto [chunkImportance, i]: order) {
+        if (freed >= needed) {
+            break;
+        }
+        //Going over the budget has to be fixed regardless, a failed load only pushes out what matters less than it.
+        if (!overBudget && chunkImportance >= failedImportance) {
+            break;
+        }
+        const ResidentChunk &chunk = candidates[i];
+        uint32_t lower = chunk.resolution / 2;
+        caps[chunk.slot] = {chunk.chunkCoord, lower >= minResolution ? lower : 0};
+        changedCaps.push_back(chunk.slot);
+        if (lower >= minResolution) {
+            downgrades++;
+        } else {
+            evictions++;
+        }
+        evicted.push_back(chunk.slot);
+        freed += chunk.bytes;
+    }
+
+    //Nothing less important to push out, load the failed chunks coarser instead of retrying them every frame.
+    if (freed < needed) {
+        for (const auto &failure: failures) {
+            uint32_t lower = failure.resolution / 2;
+            caps[failure.slot] = {failure.chunkCoord, lower >= minResolution ? lower : 0};
+            changedCaps.push_back(failure.slot);
+            if (lower >= minResolution) {
+                downgrades++;
+            } else {
+                evictions++;
+            }
+        }
+    }
+    return evicted;
+}
+
+void ResidencyManager::relax(size_t residentBytes, const std::function<float(glm::ivec3 chunkCoord)> &importance) {
+    auto now = std::chrono::steady_clock::now();
+    if (now - lastPressure < RELAX_AFTER || now - lastRelax < RELAX_INTERVAL) {
+        return;
+    }
+    //Lifting a cap loads the chunk finer again, which needs some room
+    if (budgetBytes != 0 && static_cast<double>(residentBytes) > static_cast<double>(budgetBytes) * RELAX_BELOW) {
+        return;
+    }
+    lastRelax = now;
+    size_t best = caps.size();
+    float bestImportance = -1.0f;
+    for (size_t slot = 0; slot < caps.size(); slot++) {
+        if (caps[slot].resolution == NO_CAP) {
+            continue;
+        }
+        float capImportance = importance(caps[slot].chunkCoord);
+        if (capImportance > bestImportance) {
+            best = slot;
+            bestImportance = capImportance;
+        }
+    }
+    if (best == caps.size()) {
+        return;
+    }
+    SlotCap &slotCap = caps[best];
+    slotCap.resolution = slotCap.resolution == 0 ? minResolution : slotCap.resolution * 2;
+    if (slotCap.resolution >= maxResolution) {
+        slotCap.resolution = NO_CAP;
+    }
+    changedCaps.push_back(static_cast<uint32_t>(best));
+    capsLifted++;
+}
+
+std::vector<uint32_t> ResidencyManager::takeChangedCaps() {
+    std::vector<uint32_t> changed;
+    changed.swap(changedCaps);
+    return changed;
+}
+
+void ResidencyManager::printStats(size_t residentBytes) {
+    size_t capped = std::count_if(caps.begin(), caps.end(), [](const SlotCap &slotCap) {
+        return slotCap.resolution != NO_CAP;
+    });
+    auto toMB = [](size_t bytes) { return static_cast<double>(bytes) / (1024.0 * 1024.0); };
+    if (budgetBytes != 0) {
+        spdlog::info("Residency: {:.2f}/{:.2f} MB resident", toMB(residentBytes), toMB(budgetBytes));
+    } else {
+        spdlog::info("Residency: {:.2f} MB resident, no budget", toMB(residentBytes));
+    }
+    spdlog::info("Residency: {} failed allocations, {} priority inversions, {} downgraded, {} evicted, {} slots "
+                 "capped, {} caps lifted", failedAllocations, priorityInversions, downgrades, evictions, capped,
+                 capsLifted);
+    failedAllocations = 0;
+    priorityInversions = 0;
+    downgrades = 0;
+    evictions = 0;
+    capsLifted = 0;
+}
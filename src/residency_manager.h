@@ -0,0 +1,83 @@
+#pragma once
+
+#ifndef RESIDENCY_MANAGER_H
+#define RESIDENCY_MANAGER_H
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+#include <glm/glm.hpp>
+
+//A grid chunk that holds GPU memory and could be evicted.
+struct ResidentChunk {
+    uint32_t slot;
+    glm::ivec3 chunkCoord;
+    uint32_t resolution;
+    size_t bytes;
+};
+
+//Keeps the chunks in GPU memory within a budget, and makes room when a chunk could not be allocated. The least
+//important chunks, far away and behind the camera, get evicted and their slot capped one resolution lower than it
+//held, so they come back coarser. Slots already at the lowest resolution stay empty and show the overview. The caps
+//are lifted again one at a time once there has been no pressure for a while. Main thread only, except for
+//allocationFailed.
+class ResidencyManager {
+public:
+    //A budgetBytes of 0 only reacts to failed allocations.
+    ResidencyManager(size_t budgetBytes, uint32_t slots, uint32_t minResolution, uint32_t maxResolution);
+
+    //A worker could not allocate GPU memory for the chunk it loaded into the slot.
+    void allocationFailed(uint32_t slot, glm::ivec3 chunkCoord, uint32_t resolution, size_t bytes);
+
+    //Resolution the slot may load chunkCoord at, 0 when it has to stay empty.
+    uint32_t cap(uint32_t slot, glm::ivec3 chunkCoord, uint32_t resolution) const;
+
+    //Returns the slots to evict now. importance is the load priority of a chunk, the lowest gets evicted first and a
+    //chunk is only evicted for a failed one that is more important. resident only gets called under pressure.
+    std::vector<uint32_t> update(const std::function<std::vector<ResidentChunk>()> &resident, size_t residentBytes,
+                                 const std::function<float(glm::ivec3 chunkCoord)> &importance);
+
+    //Slots whose cap got set or lifted since the last call.
+    std::vector<uint32_t> takeChangedCaps();
+
+    //Log the pressure handling since the previous call.
+    void printStats(size_t residentBytes);
+
+private:
+    struct SlotCap {
+        glm::ivec3 chunkCoord;
+        uint32_t resolution;
+    };
+
+    struct FailedAllocation {
+        uint32_t slot;
+        glm::ivec3 chunkCoord;
+        uint32_t resolution;
+        size_t bytes;
+    };
+
+    size_t budgetBytes;
+    uint32_t minResolution;
+    uint32_t maxResolution;
+    //UINT32_MAX when the slot is not capped
+    std::vector<SlotCap> caps;
+    std::vector<FailedAllocation> failed;
+    std::vector<uint32_t> changedCaps;
+    std::mutex failedMutex;
+    std::chrono::steady_clock::time_point lastPressure;
+    std::chrono::steady_clock::time_point lastRelax;
+
+    //Since the last print
+    uint64_t failedAllocations = 0;
+    uint64_t evictions = 0;
+    uint64_t downgrades = 0;
+    uint64_t priorityInversions = 0;
+    uint64_t capsLifted = 0;
+
+    //Lift the cap of the most important capped slot a level.
+    void relax(size_t residentBytes, const std::function<float(glm::ivec3 chunkCoord)> &importance);
+};
+
+#endif //RESIDENCY_MANAGER_H
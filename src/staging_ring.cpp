@@ -0,0 +1,93 @@
+#include "staging_ring.h"
+
+#include "spdlog/spdlog.h"
+
+StagingRing::StagingRing(size_t bufferSize, const std::string &name)
+    : name(name), capacity(bufferSize - RESERVED) {
+}
+
+size_t StagingRing::tryAllocate(size_t size) {
+    size_t aligned = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    if (head == tail) {
+        //Empty, start over at the front so a large allocation does not need to skip the end of the buffer
+        head = 0;
+        tail = 0;
+    }
+    size_t position = head % capacity;
+    //Allocations have to be contiguous, so skip the end of the buffer if it does not fit there.
+    size_t padding = position + aligned > capacity ? capacity - position : 0;
+    if ((head - tail) + padding + aligned > capacity) {
+        return 0;
+    }
+    uint64_t start = head + padding;
+    head = start + aligned;
+    peakUsed = std::max(peakUsed, head - tail);
+
+    size_t offset = RESERVED + start % capacity;
+    allocations.push_back({padding + aligned, false});
+    byOffset[offset] = &allocations.back();
+    return offset;
+}
+
+size_t StagingRing::allocateChunk(size_t size, std::chrono::milliseconds maxWait) {
+    if (size == 0) {
+        spdlog::error("Tried allocating 0 memory in the {}!", name);
+        return 0;
+    }
+    if (size > capacity) {
+        failedAllocations++;
+        return 0;
+    }
+    std::unique_lock<std::mutex> lock(mut);
+    size_t offset = tryAllocate(size);
+    if (offset != 0) {
+        return offset;
+    }
+
+    //Backpressure, wait for the GPU to finish copies so the tail can move.
+    stalls++;
+    auto start = std::chrono::steady_clock::now();
+    freedCv.wait_for(lock, maxWait, [&] { return (offset = tryAllocate(size)) != 0; });
+    stallMicroseconds += std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count();
+    if (offset == 0) {
+        failedAllocations++;
+    }
+    return offset;
+}
+
+void StagingRing::freeChunk(size_t offset) {
+    {
+        std::lock_guard<std::mutex> lock(mut);
+        auto it = byOffset.find(offset);
+        if (it == byOffset.end()) {
+            spdlog::error("Tried to free offset {} that is not allocated in the {}!", offset, name);
+            return;
+        }
+        it->second->freed = true;
+        byOffset.erase(it);
+        while (!allocations.empty() && allocations.front().freed) {
+            tail += allocations.front().span;
+            allocations.pop_front();
+        }
+    }
+    freedCv.notify_all();
+}
+
+void StagingRing::printBufferInfo() {
+    uint64_t used, peak;
+    size_t outstanding; {
+        std::lock_guard<std::mutex> lock(mut);
+        used = head - tail;
+        peak = peakUsed;
+        peakUsed = used;
+        outstanding = byOffset.size();
+    }
+    spdlog::info("{} ring: {:.2f} MB used ({:.2f}%), peak {:.2f}%, {} allocations, {} stalls waiting {:.2f} ms, "
+                 "{} failed", name,
+                 static_cast<double>(used) / (1024.0 * 1024.0),
+                 static_cast<double>(used) / static_cast<double>(capacity) * 100.0,
+                 static_cast<double>(peak) / static_cast<double>(capacity) * 100.0,
+                 outstanding, stalls.exchange(0), static_cast<double>(stallMicroseconds.exchange(0)) / 1000.0,
+                 failedAllocations.exchange(0));
+}
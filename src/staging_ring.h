@@ -0,0 +1,61 @@
+#pragma once
+
+#ifndef STAGING_RING_H
+#define STAGING_RING_H
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+//Allocator for the staging buffer. Uploads are close to first in first out, so instead of searching for a free
+//spot like the BufferManager, allocations are taken from the head of a ring and the tail moves forward once the
+//oldest allocations are freed, which happens when the GPU finished the copies reading from them. Allocations freed
+//out of order just hold the tail back until everything before them is freed too.
+class StagingRing {
+public:
+    StagingRing(size_t bufferSize, const std::string &name);
+
+    //Returns the byte offset in the staging buffer, never 0. When the ring is full this waits up to maxWait for
+    //uploads to retire and returns 0 if there is still no room.
+    size_t allocateChunk(size_t size, std::chrono::milliseconds maxWait = std::chrono::milliseconds(50));
+
+    void freeChunk(size_t offset);
+
+    //Log utilization and the time spent waiting for room since the previous call.
+    void printBufferInfo();
+
+private:
+    struct Allocation {
+        //Bytes taken from the ring, including the bytes skipped at the end when the allocation wrapped around.
+        size_t span;
+        bool freed;
+    };
+
+    //Offsets start after this, so 0 can be used as the failed value like in the BufferManager
+    static constexpr size_t RESERVED = 64;
+    static constexpr size_t ALIGNMENT = 64;
+
+    const std::string name;
+    size_t capacity;
+    //Byte positions that only ever grow, the offset in the buffer is RESERVED + position % capacity.
+    uint64_t head = 0;
+    uint64_t tail = 0;
+    std::deque<Allocation> allocations;
+    //Deque references stay valid when pushing and popping at the ends
+    std::unordered_map<size_t, Allocation *> byOffset;
+    std::mutex mut;
+    std::condition_variable freedCv;
+
+    uint64_t peakUsed = 0;
+    std::atomic<uint64_t> stallMicroseconds = 0;
+    std::atomic<uint64_t> stalls = 0;
+    std::atomic<uint64_t> failedAllocations = 0;
+
+    //Caller holds mut, returns 0 when there is no room.
+    size_t tryAllocate(size_t size);
+};
+
+#endif //STAGING_RING_H
@@ -1,6 +1,7 @@
 #include "structures.h"
 
 #include <format>
+#include <optional>
 #include <queue>
 
 #include "spdlog/spdlog.h"
@@ -13,13 +14,15 @@ CpuChunk::CpuChunk(uint32_t chunkFarValuesOffset, uint32_t rootIndex, uint32_t r
     offsetSize = 0;
 }
 
-Chunk::Chunk(uint32_t chunkFarValuesOffset, uint32_t rootIndex)
-    : ChunkFarValuesOffset(chunkFarValuesOffset), rootNodeIndex(rootIndex) {
+Chunk::Chunk(uint32_t chunkFarValuesOffset, uint32_t rootIndex, uint32_t maxDepth, uint32_t colorsOffset,
+             glm::ivec3 chunkCoords, uint32_t bufferIndex)
+    : ChunkFarValuesOffset(chunkFarValuesOffset), rootNodeIndex(rootIndex), maxDepth(maxDepth),
+      colorsOffset(colorsOffset), chunkCoords(chunkCoords), bufferIndex(bufferIndex) {
 }
 
 Camera::Camera(glm::vec3 pos, glm::vec3 direction, int screenWidth, int screenHeight, float fovRadian,
-               glm::ivec3 camera_grid_pos)
-    : position(pos), camera_grid_pos(camera_grid_pos), fov(fovRadian) {
+               glm::ivec3 camera_grid_pos, glm::ivec3 chunk_coords)
+    : position(pos), camera_grid_pos(camera_grid_pos), fov(fovRadian), chunk_coords(chunk_coords) {
     this->direction = glm::normalize(direction);
     spdlog::debug("Direction {}, {}, {}", direction.x, direction.y, direction.z);
     up = glm::vec3(0.0, 0.0, 1.0);
@@ -41,7 +44,7 @@ CPUCamera::CPUCamera(glm::vec3 pos, glm::vec3 direction, int screenWidth, int sc
     gridSize = config.grid_size;
     gridHeight = config.grid_height;
     maxChunkResolution = config.chunk_resolution;
-    gpu_camera = Camera(chunk_position, direction, screenWidth, screenHeight, fovRadian, camera_grid_pos);
+    gpu_camera = Camera(chunk_position, direction, screenWidth, screenHeight, fovRadian, camera_grid_pos, chunk_coords);
 }
 
 inline glm::ivec2 positive_mod(const glm::ivec2 &a, const glm::ivec2 &b) {
@@ -73,6 +76,7 @@ void CPUCamera::updatePosition(glm::vec3 posChange) {
         spdlog::debug("After camera grid pos: {}, {}, {}", gpu_camera.camera_grid_pos.x, gpu_camera.camera_grid_pos.y,
                       gpu_camera.camera_grid_pos.z);
         chunk_coords += diff;
+        gpu_camera.chunk_coords = chunk_coords;
     }
 }
 
@@ -88,6 +92,7 @@ void CPUCamera::setPosition(glm::vec3 newPosition) {
     gpu_camera.camera_grid_pos.y = gridxy.y;
 
     chunk_coords = new_chunk_coords;
+    gpu_camera.chunk_coords = chunk_coords;
 }
 
 
@@ -100,9 +105,9 @@ OctreeNode::OctreeNode(uint8_t childMask, std::array<std::shared_ptr<OctreeNode>
     : childMask(childMask), children(children), color(0) {
 }
 
-GridInfo::GridInfo(uint32_t res, uint32_t gridSize, uint32_t gridHeight)
-    : sunPosition(glm::vec3(4000, 4000, 500)), resolution(res), bufferSize(0), gridSize(gridSize),
-      gridHeight(gridHeight) {
+GridInfo::GridInfo(uint32_t res, uint32_t gridSize, uint32_t gridHeight, uint32_t overviewSize)
+    : sunPosition(glm::vec3(4000, 4000, 500)), resolution(res), bufferShift(0), gridSize(gridSize),
+      gridHeight(gridHeight), overviewSize(overviewSize) {
 }
 
 VkVertexInputBindingDescription Vertex::getBindingDescription() {
@@ -251,6 +256,69 @@ void addOctreeGPUdata(std::vector<uint32_t> &gpuData, std::shared_ptr<OctreeNode
     gpuData[startIndex] = addChildren(rootNode, &gpuData, &index, startIndex, farValues);
 }
 
+uint32_t breadthFirstNodeColors(const std::vector<uint32_t> &gpuData, const std::vector<uint32_t> &farValues,
+                                std::vector<uint32_t> &colors) {
+    colors.clear();
+    if (gpuData.empty()) {
+        return 0;
+    }
+    auto childIndex = [&](uint32_t index) -> std::optional<uint32_t> {
+        uint32_t value = gpuData[index];
+        uint32_t offset = value & 0x007FFFFFu;
+        if ((value >> 23) & 1u) {
+            if (offset >= farValues.size()) return std::nullopt;
+            offset = farValues[offset];
+        }
+        return index + offset;
+    };
+
+    //Find where every level starts, every child pointer has to land right after the children of the nodes before it.
+    std::vector<uint32_t> levelStarts = {0, 1};
+    while (true) {
+        uint32_t begin = levelStarts[levelStarts.size() - 2];
+        uint32_t end = levelStarts.back();
+        uint32_t next = end;
+        for (uint32_t i = begin; i < end; i++) {
+            uint32_t childMask = gpuData[i] >> 24;
+            if (childMask == 0) continue;
+            auto child = childIndex(i);
+            if (!child || *child != next) return 0;
+            next += std::popcount(childMask);
+            if (next > gpuData.size()) return 0;
+        }
+        if (next == end) break;
+        levelStarts.push_back(next);
+    }
+    if (levelStarts.back() != gpuData.size()) {
+        return 0;
+    }
+
+    //Bottom up, so the children of a node always have their color already.
+    colors.resize(levelStarts[levelStarts.size() - 2]);
+    auto colorOf = [&](uint32_t index) {
+        return index < colors.size() ? colors[index] : gpuData[index] & 0x00FFFFFFu;
+    };
+    for (size_t level = levelStarts.size() - 2; level-- > 0;) {
+        for (uint32_t i = levelStarts[level]; i < levelStarts[level + 1]; i++) {
+            uint32_t childMask = gpuData[i] >> 24;
+            if (childMask == 0) {
+                colors[i] = gpuData[i] & 0x00FFFFFFu;
+                continue;
+            }
+            uint32_t first = *childIndex(i);
+            uint32_t count = std::popcount(childMask);
+            glm::uvec3 sum(0);
+            for (uint32_t c = 0; c < count; c++) {
+                uint32_t color = colorOf(first + c);
+                sum += glm::uvec3((color >> 16) & 0xFFu, (color >> 8) & 0xFFu, color & 0xFFu);
+            }
+            sum /= count;
+            colors[i] = (sum.x << 16) | (sum.y << 8) | sum.z;
+        }
+    }
+    return static_cast<uint32_t>(levelStarts.size() - 1);
+}
+
 void checkChildren(uint8_t *childMask, std::array<std::shared_ptr<OctreeNode>, 8> *children,
                    std::unordered_map<uint64_t, std::shared_ptr<OctreeNode> > *sparseGrid,
                    size_t x, size_t y, size_t z) {
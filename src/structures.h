@@ -50,19 +50,37 @@ struct CpuChunk {
     uint32_t offsetSize = 0;
     glm::ivec3 chunk_coords = glm::ivec3{0, 0, 0};
     bool loading = false;
+    //Levels of the uploaded tree when it is breadth first and has its node colors uploaded, so it can be drawn at any
+    //lower resolution by only changing the chunk table. 0 when the tree can only be replaced as a whole.
+    uint32_t treeLevels = 0;
+    //Resolution the uploaded tree was generated at, resolution can be lower than this
+    uint32_t treeResolution = 0;
+    uint32_t colorsOffset = 0;
 
     CpuChunk() = default;
 
     CpuChunk(uint32_t chunkFarValuesOffset, uint32_t rootIndex, uint32_t resolution, glm::ivec3 chunk_coords);
 };
 
+//Chunk coordinates of a chunk table entry that holds nothing yet
+inline const glm::ivec3 NO_CHUNK_COORDS = glm::ivec3(INT32_MIN);
+
 struct Chunk {
     uint32_t ChunkFarValuesOffset;
     uint32_t rootNodeIndex;
+    //Nodes on this level are drawn as solid voxels, the levels below it are not traversed
+    uint32_t maxDepth;
+    //Added to the index of a node to find its color, for nodes on maxDepth that still have children
+    uint32_t colorsOffset;
+    //World chunk the entry holds, the shader falls back to the overview when it is not the chunk it needs
+    alignas(16) glm::ivec3 chunkCoords;
+    //VoxelSSBO the node indices are relative to, only used when every chunk has a buffer of its own
+    alignas(4) uint32_t bufferIndex;
 
     Chunk() = default;
 
-    Chunk(uint32_t chunkFarValuesOffset, uint32_t rootIndex);
+    Chunk(uint32_t chunkFarValuesOffset, uint32_t rootIndex, uint32_t maxDepth = 0, uint32_t colorsOffset = 0,
+          glm::ivec3 chunkCoords = NO_CHUNK_COORDS, uint32_t bufferIndex = 0);
 };
 
 struct TexturedTriangle {
@@ -84,11 +102,15 @@ struct Camera {
     alignas(16) glm::ivec3 camera_grid_pos;
     alignas(8) glm::vec2 resolution;
     alignas(4) float fov;
+    //World chunk the camera is in, to know which chunk a grid slot should hold
+    alignas(16) glm::ivec3 chunk_coords;
+    //Frames drawn, picks the pixels that write traversal feedback
+    alignas(4) uint32_t frame = 0;
 
     Camera() = default;
 
     Camera(glm::vec3 pos, glm::vec3 direction, int screenWidth, int screenHeight, float fovRadian,
-           glm::ivec3 camera_grid_pos);
+           glm::ivec3 camera_grid_pos, glm::ivec3 chunk_coords);
 };
 
 struct CPUCamera {
@@ -122,13 +144,15 @@ struct OctreeNode {
 struct GridInfo {
     alignas(16) glm::vec3 sunPosition;
     alignas(4) uint32_t resolution;
-    alignas(4) uint32_t bufferSize;
+    //Octree buffers are 1 << bufferShift elements apart in the node indices
+    alignas(4) uint32_t bufferShift;
     alignas(4) uint32_t gridSize;
     alignas(4) uint32_t gridHeight;
+    alignas(4) uint32_t overviewSize;
 
     GridInfo() = default;
 
-    GridInfo(uint32_t res, uint32_t gridSize, uint32_t gridHeight);
+    GridInfo(uint32_t res, uint32_t gridSize, uint32_t gridHeight, uint32_t overviewSize = 0);
 };
 
 struct Vertex {
@@ -161,6 +185,13 @@ void addOctreeGPUdataBF(std::vector<uint32_t> &gpuData, std::shared_ptr<OctreeNo
 void addOctreeGPUdata(std::vector<uint32_t> &gpuData, std::shared_ptr<OctreeNode> rootNode, uint32_t nodesAmount,
                       std::vector<uint32_t> &farValues);
 
+//Colors for the nodes of a breadth first octree that have children, the average of their children, so the tree can be
+//cut off at any level and still be drawn. Breadth first puts every level after the previous one, so only the nodes
+//before the deepest level get a color, indexed like the nodes. Returns the amount of levels in the tree, or 0 when
+//gpuData is not laid out breadth first.
+uint32_t breadthFirstNodeColors(const std::vector<uint32_t> &gpuData, const std::vector<uint32_t> &farValues,
+                                std::vector<uint32_t> &colors);
+
 void checkChildren(uint8_t *childMask, std::array<std::shared_ptr<OctreeNode>, 8> *children,
                    std::unordered_map<uint64_t, std::shared_ptr<OctreeNode> > *sparseGrid,
                    size_t x, size_t y, size_t z);
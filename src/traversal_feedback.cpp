@@ -0,0 +1,88 @@
+#include "traversal_feedback.h"
+
+#include <algorithm>
+#include <limits>
+
+#include "spdlog/spdlog.h"
+
+constexpr uint32_t UNKNOWN = std::numeric_limits<uint32_t>::max();
+
+TraversalFeedback::TraversalFeedback(uint32_t slots)
+    : currentWindow(slots, 0), previousWindow(slots, 0), knownFrom(slots, 0), reported(slots, UNKNOWN) {
+}
+
+uint32_t TraversalFeedback::combined(uint32_t slot) const {
+    if (frame < knownFrom[slot] + FEEDBACK_WINDOW_FRAMES) {
+        return UNKNOWN;
+    }
+    return std::max(currentWindow[slot], previousWindow[slot]);
+}
+
+void TraversalFeedback::merge(uint32_t slot, uint32_t value) {
+    currentWindow[slot] = std::max(currentWindow[slot], static_cast<uint8_t>(std::min(value, 255u)));
+}
+
+void TraversalFeedback::report(uint32_t slot) {
+    uint32_t now = combined(slot);
+    if (now != reported[slot]) {
+        reported[slot] = now;
+        changed.push_back(slot);
+    }
+}
+
+const std::vector<uint32_t> &TraversalFeedback::update(const uint32_t *values) {
+    frame++;
+    frames++;
+    changed.clear();
+    if (frame % FEEDBACK_WINDOW_FRAMES == 0) {
+        //Levels drop out with the old window, so every slot can change
+        previousWindow.swap(currentWindow);
+        std::fill(currentWindow.begin(), currentWindow.end(), 0);
+        for (uint32_t slot = 0; slot < currentWindow.size(); slot++) {
+            merge(slot, values[slot]);
+            report(slot);
+        }
+    } else {
+        //Otherwise only slots rays entered this frame can go up, most values are 0
+        for (uint32_t slot = 0; slot < currentWindow.size(); slot++) {
+            if (values[slot] != 0) {
+                merge(slot, values[slot]);
+                report(slot);
+            }
+        }
+    }
+    while (!becomingKnown.empty() && becomingKnown.front().first <= frame) {
+        report(becomingKnown.front().second);
+        becomingKnown.pop_front();
+    }
+    changes += changed.size();
+    return changed;
+}
+
+uint32_t TraversalFeedback::neededResolution(uint32_t slot) const {
+    uint32_t level = reported[slot];
+    if (level == UNKNOWN || level == 0) {
+        return level;
+    }
+    return 1u << (level - 1);
+}
+
+void TraversalFeedback::reset(uint32_t slot) {
+    currentWindow[slot] = 0;
+    previousWindow[slot] = 0;
+    knownFrom[slot] = frame;
+    reported[slot] = UNKNOWN;
+    becomingKnown.emplace_back(frame + FEEDBACK_WINDOW_FRAMES, slot);
+}
+
+void TraversalFeedback::printStats() {
+    size_t entered = 0, hidden = 0;
+    for (uint32_t level: reported) {
+        entered += level != UNKNOWN && level != 0;
+        hidden += level == 0;
+    }
+    spdlog::info("Traversal feedback: {} frames, {} slots seen by rays, {} not seen, {} changes", frames, entered,
+                 hidden, changes);
+    frames = 0;
+    changes = 0;
+}
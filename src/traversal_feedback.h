@@ -0,0 +1,58 @@
+#pragma once
+
+#ifndef TRAVERSAL_FEEDBACK_H
+#define TRAVERSAL_FEEDBACK_H
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+//Rays only sample a part of the pixels every frame, a slot has to go unseen for this long to count as hidden.
+constexpr uint32_t FEEDBACK_WINDOW_FRAMES = 32;
+
+//What the rays of the last frames needed from every grid slot, from the feedback buffer the shader fills. For every
+//slot the shader keeps the deepest octree level a sampled primary ray reached or asked for there, plus one, 0 when no
+//sampled ray entered it. A level is asked for when the voxel a ray hit covers more than a pixel, and levels are
+//given up when it covers less. The values are combined over a window of frames, so every sample position had its
+//turn. Main thread only.
+class TraversalFeedback {
+public:
+    explicit TraversalFeedback(uint32_t slots);
+
+    //Take the feedback of a frame. Returns the slots whose needed resolution changed, valid until the next call.
+    const std::vector<uint32_t> &update(const uint32_t *values);
+
+    //Resolution the rays needed in the slot over the window, 0 when none entered it and UINT32_MAX when it is not
+    //known yet.
+    uint32_t neededResolution(uint32_t slot) const;
+
+    //The slot gets another chunk, what rays needed from the old one does not count.
+    void reset(uint32_t slot);
+
+    void printStats();
+
+private:
+    uint64_t frame = 0;
+    //Level plus one of the current and the previous window, the combined maximum is what counts
+    std::vector<uint8_t> currentWindow;
+    std::vector<uint8_t> previousWindow;
+    //Frame the slot got its chunk, it is not known what it needs until a full window later
+    std::vector<uint64_t> knownFrom;
+    std::vector<uint32_t> reported;
+    //Frame every reset slot becomes known, in order
+    std::deque<std::pair<uint64_t, uint32_t> > becomingKnown;
+    std::vector<uint32_t> changed;
+
+    //Since the last print
+    uint64_t frames = 0;
+    uint64_t changes = 0;
+
+    uint32_t combined(uint32_t slot) const;
+
+    void merge(uint32_t slot, uint32_t value);
+
+    //Add the slot to changed when its combined value is not what was reported.
+    void report(uint32_t slot);
+};
+
+#endif //TRAVERSAL_FEEDBACK_H
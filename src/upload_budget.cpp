@@ -0,0 +1,79 @@
+#include "upload_budget.h"
+
+#include <algorithm>
+
+#include "spdlog/spdlog.h"
+
+UploadBudget::UploadBudget(double targetFrameMs, size_t maxBytes, uint32_t maxChunks)
+    : targetFrameMs(targetFrameMs),
+      minBytes(std::max<size_t>(maxBytes / 16, 1)),
+      maxBytes(std::max<size_t>(maxBytes, 1)),
+      minChunks(std::max(maxChunks / 16, 1u)),
+      maxChunks(std::max(maxChunks, 1u)),
+      byteBudget(static_cast<double>(this->maxBytes)),
+      chunkBudget(static_cast<double>(this->maxChunks)) {
+}
+
+void UploadBudget::beginFrame() {
+    auto now = std::chrono::steady_clock::now();
+    double frameMs = std::chrono::duration<double, std::milli>(now - lastFrame).count();
+    lastFrame = now;
+
+    if (!firstFrame) {
+        frames++;
+        totalBytes += frameBytes;
+        totalChunks += frameChunks;
+        peakBytes = std::max(peakBytes, frameBytes);
+        peakChunks = std::max(peakChunks, frameChunks);
+
+        if (targetFrameMs > 0.0) {
+            if (frameMs > targetFrameMs * 1.1) {
+                slowFrames++;
+                //Only back off when uploads were part of the slow frame, otherwise it is something else.
+                if (frameChunks > 0) {
+                    byteBudget *= 0.75;
+                    chunkBudget *= 0.75;
+                }
+            } else if (frameMs < targetFrameMs * 0.9) {
+                byteBudget += static_cast<double>(maxBytes) / 32.0;
+                chunkBudget += static_cast<double>(maxChunks) / 32.0;
+            }
+            byteBudget = std::clamp(byteBudget, static_cast<double>(minBytes), static_cast<double>(maxBytes));
+            chunkBudget = std::clamp(chunkBudget, static_cast<double>(minChunks), static_cast<double>(maxChunks));
+        }
+    }
+    firstFrame = false;
+    frameBytes = 0;
+    frameChunks = 0;
+}
+
+bool UploadBudget::fits(size_t bytes) const {
+    if (frameChunks == 0) return true;
+    return frameChunks + 1 <= static_cast<uint32_t>(chunkBudget) &&
+           static_cast<double>(frameBytes + bytes) <= byteBudget;
+}
+
+void UploadBudget::consume(size_t bytes) {
+    frameBytes += bytes;
+    frameChunks++;
+}
+
+void UploadBudget::defer(size_t chunks) {
+    if (chunks == 0) return;
+    deferredFrames++;
+    peakDeferred = std::max(peakDeferred, chunks);
+}
+
+void UploadBudget::printStats() {
+    double frameCount = static_cast<double>(std::max<uint64_t>(frames, 1));
+    spdlog::info("Upload budget: {:.2f} MB and {} chunks per frame, avg {:.2f} MB / {:.1f} chunks, peak {:.2f} MB / {} "
+                 "chunks, {} frames over target, {} frames deferring (peak {} chunks)",
+                 byteBudget / (1024.0 * 1024.0), static_cast<uint32_t>(chunkBudget),
+                 static_cast<double>(totalBytes) / frameCount / (1024.0 * 1024.0),
+                 static_cast<double>(totalChunks) / frameCount,
+                 static_cast<double>(peakBytes) / (1024.0 * 1024.0), peakChunks, slowFrames, deferredFrames,
+                 peakDeferred);
+    frames = slowFrames = totalBytes = totalChunks = deferredFrames = 0;
+    peakBytes = peakDeferred = 0;
+    peakChunks = 0;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#ifndef UPLOAD_BUDGET_H
+#define UPLOAD_BUDGET_H
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+//Limits how much gets uploaded per frame, so a burst of finished chunks after crossing a chunk border gets spread over
+//a few frames instead of making one frame take much longer. The limits shrink quickly when frames take longer than
+//the target and grow back slowly while there is time to spare.
+class UploadBudget {
+public:
+    //A targetFrameMs of 0 keeps the budget fixed at the maximum.
+    UploadBudget(double targetFrameMs, size_t maxBytes, uint32_t maxChunks);
+
+    //Start the next frame, adapting the budget to how long the previous frame took.
+    void beginFrame();
+
+    //Whether a chunk upload of the given size still fits in this frame. The first chunk of a frame always fits, so a
+    //chunk bigger than the budget does not get stuck.
+    bool fits(size_t bytes) const;
+
+    void consume(size_t bytes);
+
+    //Chunks that were ready but have to wait for a later frame.
+    void defer(size_t chunks);
+
+    //Log the per frame upload volume and budget since the previous call.
+    void printStats();
+
+private:
+    double targetFrameMs;
+    size_t minBytes;
+    size_t maxBytes;
+    uint32_t minChunks;
+    uint32_t maxChunks;
+    double byteBudget;
+    double chunkBudget;
+
+    std::chrono::steady_clock::time_point lastFrame;
+    bool firstFrame = true;
+    size_t frameBytes = 0;
+    uint32_t frameChunks = 0;
+
+    //Stats since the last print
+    uint64_t frames = 0;
+    uint64_t slowFrames = 0;
+    uint64_t totalBytes = 0;
+    uint64_t totalChunks = 0;
+    size_t peakBytes = 0;
+    uint32_t peakChunks = 0;
+    uint64_t deferredFrames = 0;
+    size_t peakDeferred = 0;
+};
+
+#endif //UPLOAD_BUDGET_H